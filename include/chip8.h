@@ -2,13 +2,29 @@
 #define CHIP8_H
 
 #include <SDL.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+// Pixel art upscaling filters
+typedef enum {
+    FILTER_RECTS,       // Draw a rectangle per pixel, supports pixel outlines
+    FILTER_NEAREST,     // Upload 1:1, renderer scales with nearest sampling
+    FILTER_SCALE2X,
+    FILTER_SCALE3X,
+    FILTER_SCALE4X,
+    FILTER_CRT,         // 4x with scanlines and an aperture grille mask
+    FILTER_COUNT,
+} filter_t;
+
+#define SCALER_MAX_WIDTH  128   // Largest display the scalers handle, SUPERCHIP/XOCHIP hires
+#define SCALER_MAX_HEIGHT 64
+
 // SDL Container object
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *textures[FILTER_COUNT];    // Streaming texture per upscaling filter, NULL for FILTER_RECTS
     SDL_AudioSpec want, have;
     SDL_AudioDeviceID dev;
 } sdl_t;
@@ -27,6 +43,18 @@ typedef enum {
     XOCHIP,
 } extension_t;
 
+// Virtual clock timing profiles
+typedef enum {
+    TIMING_FAST,    // Every instruction costs 1 cycle, insts_per_second cycles per second
+    TIMING_VIP,     // Approximate COSMAC VIP costs in 1802 machine cycles
+} timing_t;
+
+// Headless export frame stream formats
+typedef enum {
+    EXPORT_Y4M,     // YUV4MPEG2 4:2:0, e.g. for piping into ffmpeg
+    EXPORT_RGBA,    // Raw RGBA bytes, one frame after another
+} export_format_t;
+
 // Emulator configuration object
 typedef struct {
     uint32_t window_width;      // SDL window width
@@ -41,8 +69,108 @@ typedef struct {
     int16_t volume;             // How loud or not is the sound
     float color_lerp_rate;      // Amount to lerp colors by, between [0.1, 1.0]
     extension_t current_extension;  // Current quirks/extension support for e.g. CHIP8 vs. SUPERCHIP
+    uint32_t rng_seed;          // Seed for the CXNN random number generator
+    uint32_t run_ahead_frames;  // Frames to emulate ahead of the displayed frame, 0 = off, 1-4
+    timing_t timing;            // Per-opcode cycle cost profile for the virtual clock
+    const char *trace_file;     // Write a binary execution trace here, NULL for none
+    bool debugger;              // Run the debugger console on stdin/stdout
+    const char *latency_file;   // Measure input to photon latency, write histograms here
+    filter_t filter;            // Upscaling filter used to draw the display
+    bool profile;               // Count instructions & superinstructions, log them on exit
+    const char *export_file;    // Headless export: write every frame here ("-" for stdout), NULL for none
+    export_format_t export_format;
+    uint32_t export_frames;     // Frames to emulate & export
+    uint32_t png_every;         // Also write every Nth exported frame as a PNG, 0 for none
+    const char *png_prefix;     // PNG file name prefix, frame number and .png are appended
+    const char *wav_file;       // Export audio as WAV here, NULL for none
+    const char *input_file;     // Replay keypad input from this log, NULL for none
 } config_t;
 
+// Lock-free single producer/single consumer ring buffer of audio samples; the emulation
+//   thread renders samples in step with emulated time, the audio callback only copies them out
+#define AUDIO_RING_SIZE 8192    // Samples, must be a power of 2
+typedef struct {
+    int16_t samples[AUDIO_RING_SIZE];
+    SDL_atomic_t head;          // Free running write position, only advanced by the producer
+    SDL_atomic_t tail;          // Free running read position, only advanced by the consumer
+    SDL_atomic_t volume;        // Current config volume, set by the input thread
+    SDL_atomic_t underruns;     // Number of callbacks that ran out of samples while producing
+    SDL_atomic_t producing;     // Non-zero while the emulation thread is rendering samples
+    uint32_t sample_rate;       // Device sample rate, from the obtained audio spec
+    uint32_t target_fill;       // Samples to keep buffered, rate control steers towards this, 0 for none
+    uint32_t square_wave_freq;  // Frequency of CHIP8 tone
+    uint64_t last_cycle;        // Virtual clock cycle samples have been rendered up to
+    double sample_frac;         // Fractional sample carried over between renders
+    double phase;               // Oscillator position, in pattern bits
+} audio_t;
+
+// Execution trace record, one per executed instruction, state after execution
+typedef struct {
+    uint16_t PC;            // Address the instruction was fetched from
+    uint16_t opcode;
+    uint16_t I;             // Index register
+    uint8_t X;              // Register the instruction may have changed
+    uint8_t VX;             // Value of that register
+    uint8_t VF;             // Flag register
+} trace_record_t;
+
+#define TRACE_RECORD_SIZE 9         // Bytes per record in the trace file
+#define TRACE_BUFFER_RECORDS 65536  // Records per buffer handed to the writer thread
+
+typedef struct trace_buffer {
+    trace_record_t records[TRACE_BUFFER_RECORDS];
+    uint32_t count;
+    struct trace_buffer *next;
+} trace_buffer_t;
+
+// Execution trace writer. The emulating thread fills its own buffer without locking, full
+//   buffers are handed to a background thread that delta/run-length compresses and writes them.
+typedef struct {
+    FILE *file;
+    trace_buffer_t *current;    // Being filled by the emulating thread
+    trace_buffer_t *full;       // Queue of full buffers for the writer thread
+    trace_buffer_t *free;       // Buffers the writer thread is done with
+    uint32_t num_buffers;       // Buffers allocated, up to a fixed limit
+    SDL_mutex *lock;            // Protects full/free/quit/failed, taken once per buffer
+    SDL_cond *cond;
+    SDL_Thread *thread;
+    bool quit;
+    bool failed;                // Writer could not write, records are dropped from then on
+    uint64_t records;           // Total records written
+    uint64_t bytes;             // Total compressed bytes written
+} trace_t;
+
+// Input to photon latency probe for one keypress, host performance counter timestamps
+typedef struct {
+    uint64_t keydown;       // SDL_KEYDOWN handled
+    uint64_t observed;      // First EX9E/EXA1/FX0A that saw the key pressed
+    uint64_t drawn;         // First DXYN after that
+} latency_probe_t;
+
+#define LATENCY_MAX_PROBES 4    // Completed probes carried per frame
+#define LATENCY_BUCKETS 100     // 1ms histogram buckets, the last one also counts anything slower
+
+typedef enum {
+    LATENCY_OBSERVE,        // Keydown to key observed by the ROM
+    LATENCY_DRAW,           // Keydown to first draw after that
+    LATENCY_PRESENT,        // Keydown to SDL_RenderPresent of that draw
+    LATENCY_STAGES,
+} latency_stage_t;
+
+// Input to photon latency tracker. Keypresses are timestamped on the input thread, followed
+//   through the ROM on the emulation thread, and completed when the frame is presented.
+typedef struct {
+    SDL_mutex *lock;                // Protects pressed
+    uint64_t pressed[16];           // Keydowns not yet latched by the emulation thread
+    latency_probe_t keys[16];       // Emulation thread: probes in flight by key, keydown 0 if none
+    latency_probe_t drawn[LATENCY_MAX_PROBES];  // Emulation thread: drawn, waiting for a frame
+    uint32_t num_drawn;
+    uint32_t histogram[LATENCY_STAGES][LATENCY_BUCKETS];    // Render thread: results
+    double total_ms[LATENCY_STAGES];
+    double max_ms[LATENCY_STAGES];
+    uint64_t count;
+} latency_t;
+
 // CHIP8 Instruction format
 typedef struct {
     uint16_t opcode;
@@ -53,12 +181,45 @@ typedef struct {
     uint8_t Y;      // 4 bit register identifier
 } instruction_t;
 
+// Decode cache entry, one per ram address
+typedef enum {
+    DECODE_EMPTY,   // Not decoded yet, or ram it was decoded from was written
+    DECODE_VALID,
+    DECODE_BREAK,   // Breakpoint patched in by the debugger, stops emulation
+} decode_kind_t;
+
+// Peephole fused instruction sequences (superinstructions), recognized when decoding
+typedef enum {
+    FUSION_NONE,
+    FUSION_DRAW,        // ANNN, DXYN: Point I at a sprite and draw it
+    FUSION_TIMER_WAIT,  // FX07, 3X00, 1NNN back to the FX07: Spin until the delay timer is 0
+    FUSION_ADD,         // 6YNN, 8XY4: Add a constant to VX with carry
+    FUSION_BCD_LOAD,    // FX33, FX65: Store BCD digits, load them back into registers
+    FUSION_COUNT,
+} fusion_t;
+
+#define DECODE_SPAN 6   // Bytes of ram a decode cache entry is decoded from, up to 3 fused instructions
+
+typedef struct {
+    instruction_t inst;
+    uint8_t kind;   // decode_kind_t
+    uint8_t fusion; // fusion_t, superinstruction starting at this entry
+} decoded_t;
+
+// Instruction profile counters, and the render thread's upscaling cost
+typedef struct {
+    uint64_t instructions;              // Instructions retired
+    uint64_t fusions[FUSION_COUNT];     // Superinstructions run, by fusion
+    uint64_t skipped_waits;             // Timer wait loop iterations fast forwarded over
+    uint64_t upscale_frames[FILTER_COUNT];      // Render thread: frames upscaled, by filter
+    uint64_t upscale_ticks[FILTER_COUNT];       // Performance counter ticks spent in upscale()
+    uint64_t upscale_max_ticks[FILTER_COUNT];   // Worst single frame
+} profile_t;
+
 // CHIP8 Machine object
 typedef struct {
-    emulator_state_t state;
     uint8_t ram[4096];
     bool display[64*32];    // Emulate original CHIP8 resolution pixels
-    uint32_t pixel_color[64*32];    // CHIP8 pixel colors to draw
     uint16_t stack[12];     // Subroutine stack
     uint16_t *stack_ptr;
     uint8_t V[16];          // Data registers V0-VF
@@ -70,19 +231,189 @@ typedef struct {
     const char *rom_name;   // Currently running ROM
     instruction_t inst;     // Currently executing instruction
     bool draw;              // Update the screen yes/no
+    bool key_wait_pressed;  // FX0A: A key has been pressed, waiting for its release
+    uint8_t key_wait_key;   // FX0A: Key being waited on, 0xFF if none yet
+    uint8_t draw_x;         // DXYN: VX as read before the draw, which may set VF; for its VIP cost
+    uint32_t rng;           // CXNN random number generator state (xorshift32)
+    uint64_t cycles;        // Virtual clock, emulated cycles since reset
+    uint64_t frames;        // 60hz timer ticks since reset
+    uint8_t audio_pattern[16];  // XO-CHIP 1-bit audio pattern buffer
+    uint8_t pitch;          // XO-CHIP pattern playback pitch
+    audio_t *audio;         // Audio sample output, NULL for no audio (e.g. run-ahead frames)
+    trace_t *trace;         // Execution trace output, NULL for no tracing
+    latency_t *latency;     // Input latency tracker, NULL if not measuring
+    profile_t *profile;     // Instruction profile counters, NULL if not profiling
+    decoded_t decoded[4096];    // Decode cache, indexed by instruction address; keep last, snapshots stop here
 } chip8_t;
 
+// Run-ahead state & CPU cost accounting
+typedef struct {
+    chip8_t snapshot;       // Real machine state saved while emulating ahead, up to the decode cache
+    uint64_t frames;        // Number of frames presented from run-ahead state
+    uint64_t total_ticks;   // Performance counter ticks spent snapshotting/emulating ahead/restoring
+    uint64_t max_ticks;     // Worst single frame cost
+} run_ahead_t;
+
+// Completed frame, produced by the emulation thread and consumed by the render thread
+typedef struct {
+    bool display[64*32];    // CHIP8 display pixels for this frame
+    latency_probe_t probes[LATENCY_MAX_PROBES];     // Keypresses whose result this frame shows
+    uint32_t num_probes;
+} frame_t;
+
+// Lock-free single producer/single consumer triple buffer of frames.
+//   The producer and consumer each own one frame, the third is swapped through "middle".
+#define FRAME_INDEX_MASK 0x3
+#define FRAME_READY      0x4    // Set in middle when it holds a frame the consumer hasn't seen
+typedef struct {
+    frame_t frames[3];
+    SDL_atomic_t middle;    // Index of shared frame | FRAME_READY
+    int write;              // Index of frame owned by the producer (emulation thread)
+    int read;               // Index of frame owned by the consumer (render thread)
+} triple_buffer_t;
+
+// Debugger watchpoint targets
+typedef enum {
+    WATCH_RAM,      // Byte of ram at address
+    WATCH_I,        // Index register
+    WATCH_V,        // Data register V[address]
+} watch_type_t;
+
+typedef struct {
+    watch_type_t type;
+    uint16_t address;   // Ram address or register number
+    uint16_t value;     // Value before the current instruction
+} watchpoint_t;
+
+#define MAX_BREAKPOINTS 16
+#define MAX_WATCHPOINTS 16
+
+// Debugger state, commands come from a console thread and run on the emulation thread
+//   between frames or while stopped, never per instruction
+typedef struct {
+    uint16_t breakpoints[MAX_BREAKPOINTS];
+    uint32_t num_breakpoints;
+    watchpoint_t watchpoints[MAX_WATCHPOINTS];
+    uint32_t num_watchpoints;
+    int32_t step_over_address;  // Temporary breakpoint for step over, -1 for none
+    uint32_t step_over_depth;   // Stack depth the step over started at
+    bool stopped;               // Stopped at breakpoint/watchpoint/step, waiting for commands
+    bool at_breakpoint;         // Stopped before a breakpoint's instruction, continue steps past it
+    SDL_Thread *console;        // Reads commands from stdin
+    SDL_mutex *lock;            // Protects command
+    SDL_cond *cond;
+    SDL_atomic_t pending;       // Non-zero when command holds a command to run
+    char command[128];
+} debugger_t;
+
+// Keypad input log entry, replayed at the start of a frame
+typedef struct {
+    uint64_t frame;
+    uint8_t key;
+    bool pressed;
+} input_event_t;
+
+// Emulated frame queued for the export encoder
+#define EXPORT_QUEUE_SIZE 16        // Frames the emulator can get ahead of the encoder
+#define EXPORT_MAX_SAMPLES 4096     // Audio samples per frame, more than enough at any 60hz rate
+typedef struct {
+    uint64_t frame;
+    bool display[64*32];
+    int16_t samples[EXPORT_MAX_SAMPLES];
+    uint32_t num_samples;
+} export_frame_t;
+
+// Headless exporter. The emulating thread fills queued frames, a background encoder thread
+//   converts & writes them, blocking the emulation only when the bounded queue is full.
+typedef struct {
+    FILE *video;
+    FILE *wav;
+    export_frame_t queue[EXPORT_QUEUE_SIZE];
+    uint64_t head;              // Frames queued, advanced by the emulating thread
+    uint64_t tail;              // Frames encoded, advanced by the encoder thread
+    SDL_mutex *lock;            // Protects head/tail/quit/failed, taken once per frame
+    SDL_cond *cond;
+    SDL_Thread *thread;
+    bool quit;
+    bool failed;                // Encoder could not write, the export stops
+    uint8_t *image;             // Encoder scratch: scaled frame in the output format
+    uint64_t samples;           // Total audio samples written
+    input_event_t *events;      // Input log, sorted by frame
+    uint32_t num_events;
+} exporter_t;
+
+// Emulator core running on its own thread, shared with the render/input thread
+typedef struct {
+    chip8_t chip8;          // Owned by the emulation thread
+    config_t config;        // Emulation thread's copy of the configuration
+    audio_t audio;          // Samples from the emulation thread to the audio callback
+    trace_t trace;          // Execution trace writer, if config.trace_file is set
+    debugger_t debugger;    // Debugger, if config.debugger is set
+    latency_t latency;      // Input latency tracker, if config.latency_file is set
+    profile_t profile;      // Instruction profile, if config.profile is set
+    exporter_t export;      // Headless exporter, if config.export_file is set
+    run_ahead_t ahead;
+    triple_buffer_t frames; // Completed frames for the render thread
+    SDL_atomic_t state;     // emulator_state_t, set by the input thread
+    SDL_atomic_t keypad;    // Bitmask of pressed CHIP8 keys, set by the input thread
+    SDL_atomic_t reset;     // Non-zero when the input thread requested a reset
+    SDL_Thread *thread;
+} emulator_t;
+
 // Function declarations
-bool init_sdl(sdl_t *sdl, config_t *config);
+bool init_sdl(sdl_t *sdl, config_t *config, audio_t *audio);
 void final_cleanup(const sdl_t sdl);
 void audio_callback(void *userdata, uint8_t *stream, int len);
 bool set_config_from_args(config_t *config, const int argc, char **argv);
 bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]);
+bool init_chip8_from_memory(chip8_t *chip8, const config_t config, const uint8_t rom[], const size_t rom_size);
 void clear_screen(const sdl_t sdl, const config_t config);
-void update_screen(const sdl_t sdl, const config_t config, chip8_t *chip8);
-void handle_input(chip8_t *chip8, config_t *config);
+void update_screen(const sdl_t sdl, const config_t config, const bool display[], uint32_t pixel_color[], profile_t *profile);
+void handle_input(emulator_t *emu, config_t *config, uint32_t pixel_color[]);
 void emulate_instruction(chip8_t *chip8, const config_t config);
-void update_timers(const sdl_t sdl, chip8_t *chip8);
+bool emulate_cached_instruction(chip8_t *chip8, const config_t config);
+bool emulate_fused_step(chip8_t *chip8, const config_t config, const uint64_t frame_end);
+bool emulate_frame(chip8_t *chip8, const config_t config);
+void invalidate_decoded(chip8_t *chip8, const uint16_t address, const uint16_t length);
+void end_frame(chip8_t *chip8, const config_t config);
+void update_timers(chip8_t *chip8);
+void report_profile(const profile_t *profile);
+uint32_t cycles_per_second(const config_t config);
+uint64_t next_frame_cycle(const chip8_t *chip8, const config_t config);
+void render_audio(chip8_t *chip8, const config_t config);
+void start_audio(audio_t *audio);
+void stop_audio(audio_t *audio);
+bool start_trace(trace_t *trace, const char path[]);
+void stop_trace(trace_t *trace);
+void trace_instruction(trace_t *trace, const chip8_t *chip8, const uint16_t PC);
+FILE *open_trace(const char path[]);
+bool read_trace_block(FILE *file, trace_record_t records[], uint32_t *count);
+bool start_debugger(debugger_t *debugger);
+void stop_debugger(debugger_t *debugger);
+void apply_breakpoints(const debugger_t *debugger, chip8_t *chip8);
+bool debug_commands(debugger_t *debugger, chip8_t *chip8, const config_t config);
+bool debug_emulate_frame(debugger_t *debugger, chip8_t *chip8, const config_t config);
+bool start_latency(latency_t *latency);
+void latency_keydown(latency_t *latency, const uint8_t key);
+void latency_latch(latency_t *latency);
+void latency_observe(latency_t *latency, const uint8_t key);
+void latency_draw(latency_t *latency);
+void latency_publish(latency_t *latency, frame_t *frame);
+void latency_requeue(latency_t *latency, const frame_t *frame);
+void latency_present(latency_t *latency, const frame_t *frame);
+void report_latency(latency_t *latency, const char path[]);
+bool run_ahead(chip8_t *chip8, const config_t config, bool display[], run_ahead_t *ahead);
+void report_run_ahead(const run_ahead_t *ahead);
+uint32_t filter_scale(const filter_t filter);
+void upscale(const filter_t filter, const uint32_t src[], const uint32_t w, const uint32_t h,
+             uint32_t dst[], const uint32_t dst_pitch);
+void init_triple_buffer(triple_buffer_t *tb);
+frame_t *triple_buffer_write_frame(triple_buffer_t *tb);
+bool triple_buffer_publish(triple_buffer_t *tb);
+const frame_t *triple_buffer_read_frame(triple_buffer_t *tb);
+bool start_emulator_thread(emulator_t *emu);
+void stop_emulator_thread(emulator_t *emu);
+bool run_export(emulator_t *emu, const char rom_name[]);
 
 uint32_t color_lerp(const uint32_t start_color, const uint32_t end_color, const float t);
 
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+// Rate control: nudge the number of samples rendered per emulated second by at most this much
+//   to keep the ring buffer near its target fill, without audible pitch change
+#define AUDIO_MAX_RATE_ADJUST 0.005
+
+// 1-bit pattern for the plain CHIP8 tone: 2 bits per period, high then low
+static const uint8_t square_pattern[1] = { 0x80 };
+
+// Get bit i of a 1-bit audio pattern as a -1/+1 sample value
+static inline float pattern_value(const uint8_t pattern[], const uint32_t i) {
+    return ((pattern[i >> 3] >> (7 - (i & 7))) & 1) ? 1.0f : -1.0f;
+}
+
+// Render audio samples up to the current virtual clock cycle into the ring buffer.
+//   Called at every point the tone can change (FX18, XO-CHIP F002/FX3A, timer ticks), so
+//   beeps start and stop on the sample matching the emulated cycle, not on frame boundaries.
+//   Steps between pattern bits are band-limited with PolyBLEP corrections to avoid aliasing.
+void render_audio(chip8_t *chip8, const config_t config) {
+    audio_t *audio = chip8->audio;
+    if (!audio) return;
+
+    if (chip8->cycles < audio->last_cycle)
+        audio->last_cycle = chip8->cycles;  // Machine was reset
+
+    const uint64_t elapsed = chip8->cycles - audio->last_cycle;
+    audio->last_cycle = chip8->cycles;
+
+    // Dynamic rate control, render slightly more samples when under target fill and vice versa;
+    //   a target fill of 0 renders at exactly the sample rate (e.g. headless export)
+    const uint32_t head = SDL_AtomicGet(&audio->head);
+    const uint32_t fill = head - (uint32_t)SDL_AtomicGet(&audio->tail);
+    double ratio = 1.0;
+    if (audio->target_fill > 0) {
+        ratio += AUDIO_MAX_RATE_ADJUST * ((double)audio->target_fill - fill) / audio->target_fill;
+        if (ratio < 1.0 - AUDIO_MAX_RATE_ADJUST) ratio = 1.0 - AUDIO_MAX_RATE_ADJUST;
+        if (ratio > 1.0 + AUDIO_MAX_RATE_ADJUST) ratio = 1.0 + AUDIO_MAX_RATE_ADJUST;
+    }
+
+    audio->sample_frac += (double)elapsed * audio->sample_rate * ratio / cycles_per_second(config);
+    uint32_t count = (uint32_t)audio->sample_frac;
+    audio->sample_frac -= count;
+
+    // Drop samples that don't fit, the consumer has stalled
+    if (count > AUDIO_RING_SIZE - fill) count = AUDIO_RING_SIZE - fill;
+    if (count == 0) return;
+
+    // Pattern to play: XO-CHIP pattern buffer at its pitch, or the CHIP8 square wave
+    const uint8_t *pattern = square_pattern;
+    uint32_t bits = 2;
+    double bit_rate = 2.0 * audio->square_wave_freq;
+    if (config.current_extension == XOCHIP) {
+        pattern = chip8->audio_pattern;
+        bits = 128;
+        bit_rate = 4000.0 * SDL_pow(2.0, (chip8->pitch - 64) / 48.0);
+    }
+
+    const bool sound_on = chip8->sound_timer > 0;
+    const float volume = (float)SDL_AtomicGet(&audio->volume);
+    const double dt = bit_rate / audio->sample_rate;  // Pattern bits per sample
+    const float inv_dt = (float)(1.0 / dt);
+    const bool band_limit = dt < 1.0;   // PolyBLEP needs steps further apart than a sample
+    double phase = audio->phase;
+
+    for (uint32_t i = 0; i < count; i++) {
+        float sample = 0.0f;
+
+        if (sound_on) {
+            const uint32_t bit = (uint32_t)phase;
+            const float t = (float)(phase - bit);
+            const float cur = pattern_value(pattern, bit);
+            sample = cur;
+
+            if (band_limit) {
+                if (t < dt) {
+                    // Just after a step from the previous bit
+                    const float u = t * inv_dt;
+                    const float step = cur - pattern_value(pattern, bit ? bit - 1 : bits - 1);
+                    sample += step * 0.5f * (u + u - u * u - 1.0f);
+                } else if (t > 1.0 - dt) {
+                    // Just before a step to the next bit
+                    const float u = (t - 1.0f) * inv_dt;
+                    const float step = pattern_value(pattern, bit + 1 < bits ? bit + 1 : 0) - cur;
+                    sample += step * 0.5f * (u * u + u + u + 1.0f);
+                }
+            }
+            sample *= volume;
+        }
+
+        audio->samples[(head + i) & (AUDIO_RING_SIZE - 1)] = (int16_t)sample;
+
+        phase += dt;
+        if (phase >= bits) phase -= bits;
+    }
+
+    audio->phase = phase;
+    SDL_AtomicSet(&audio->head, head + count);  // Publish, full barrier orders the sample writes
+}
+
+// Queue silence up to the target fill and mark the producer running. Called by the emulation
+//   thread when it starts or resumes, so rate control starts at its target instead of from empty.
+void start_audio(audio_t *audio) {
+    if (SDL_AtomicGet(&audio->producing)) return;
+
+    const uint32_t head = SDL_AtomicGet(&audio->head);
+    const uint32_t fill = head - (uint32_t)SDL_AtomicGet(&audio->tail);
+    const uint32_t count = audio->target_fill > fill ? audio->target_fill - fill : 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        audio->samples[(head + i) & (AUDIO_RING_SIZE - 1)] = 0;
+
+    SDL_AtomicSet(&audio->head, head + count);
+    SDL_AtomicSet(&audio->producing, 1);
+}
+
+// Mark the producer idle (paused, stopped in the debugger), running dry is expected then
+void stop_audio(audio_t *audio) {
+    SDL_AtomicSet(&audio->producing, 0);
+}
+
+// Audio device callback, only copies already rendered samples out of the ring buffer
+void audio_callback(void *userdata, uint8_t *stream, int len) {
+    audio_t *audio = (audio_t *)userdata;
+    int16_t *audio_data = (int16_t *)stream;
+
+    // We are filling out 2 bytes at a time (int16_t), len is in bytes, so divide by 2
+    const uint32_t wanted = len / 2;
+    const uint32_t tail = SDL_AtomicGet(&audio->tail);
+    const uint32_t available = (uint32_t)SDL_AtomicGet(&audio->head) - tail;
+    const uint32_t count = available < wanted ? available : wanted;
+
+    // Copy in up to 2 pieces, when wrapping around the end of the ring
+    const uint32_t start = tail & (AUDIO_RING_SIZE - 1);
+    const uint32_t first = count < AUDIO_RING_SIZE - start ? count : AUDIO_RING_SIZE - start;
+    memcpy(audio_data, &audio->samples[start], first * sizeof(int16_t));
+    memcpy(audio_data + first, &audio->samples[0], (count - first) * sizeof(int16_t));
+
+    // Ran dry, fill the rest with silence; only an underrun if the emulation thread is producing
+    //   (not e.g. paused) and stalled
+    if (count < wanted) {
+        memset(audio_data + count, 0, (wanted - count) * sizeof(int16_t));
+        if (SDL_AtomicGet(&audio->producing)) SDL_AtomicAdd(&audio->underruns, 1);
+    }
+
+    SDL_AtomicSet(&audio->tail, tail + count);
+}
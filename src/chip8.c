@@ -22,6 +22,21 @@ bool set_config_from_args(config_t *config, const int argc, char **argv) {
         .volume = 3000,             // INT16_MAX would be max volume
         .color_lerp_rate = 0.7,     // Color lerp rate, between [0.1, 1.0]
         .current_extension = CHIP8, // Set default quirks/extension to plain OG CHIP-8
+        .rng_seed = (uint32_t)time(NULL),   // Different random numbers each run unless --seed is given
+        .run_ahead_frames = 0,      // Run-ahead off by default
+        .timing = TIMING_FAST,      // 1 cycle per instruction
+        .trace_file = NULL,         // No execution trace
+        .debugger = false,          // No debugger console
+        .latency_file = NULL,       // No input latency measurement
+        .filter = FILTER_RECTS,     // Rectangle per pixel
+        .profile = false,           // No instruction profile
+        .export_file = NULL,        // Run in a window, no headless export
+        .export_format = EXPORT_Y4M,
+        .export_frames = 600,       // 10 seconds
+        .png_every = 0,             // No PNG snapshots
+        .png_prefix = "frame",      // frame000000.png, frame000060.png, ...
+        .wav_file = NULL,           // No WAV export
+        .input_file = NULL,         // No input log
     };
 
     // Override defaults from passed in arguments
@@ -33,12 +48,129 @@ bool set_config_from_args(config_t *config, const int argc, char **argv) {
                 i++;
                 config->scale_factor = (uint32_t)strtol(argv[i], NULL, 10);
             }
+
+            // e.g. set random number generator seed, for reproducible runs
+            if (strncmp(argv[i], "--seed", strlen("--seed")) == 0) {
+                i++;
+                config->rng_seed = (uint32_t)strtoul(argv[i], NULL, 10);
+            }
+
+            // e.g. set number of run-ahead frames
+            if (strncmp(argv[i], "--run-ahead", strlen("--run-ahead")) == 0) {
+                i++;
+                config->run_ahead_frames = (uint32_t)strtol(argv[i], NULL, 10);
+                if (config->run_ahead_frames < 1 || config->run_ahead_frames > 4) {
+                    SDL_Log("--run-ahead must be between 1 and 4 frames\n");
+                    return false;
+                }
+            }
+
+            // e.g. set virtual clock timing profile
+            if (strncmp(argv[i], "--timing", strlen("--timing")) == 0) {
+                i++;
+                if (strcmp(argv[i], "fast") == 0) {
+                    config->timing = TIMING_FAST;
+                } else if (strcmp(argv[i], "vip") == 0) {
+                    config->timing = TIMING_VIP;
+                } else {
+                    SDL_Log("Unknown --timing profile %s, expected fast or vip\n", argv[i]);
+                    return false;
+                }
+            }
+
+            // e.g. write an execution trace
+            if (strncmp(argv[i], "--trace", strlen("--trace")) == 0) {
+                i++;
+                config->trace_file = argv[i];
+            }
+
+            // e.g. run the debugger console
+            if (strncmp(argv[i], "--debug", strlen("--debug")) == 0) {
+                config->debugger = true;
+            }
+
+            // e.g. measure input to photon latency
+            if (strncmp(argv[i], "--latency", strlen("--latency")) == 0) {
+                i++;
+                config->latency_file = argv[i];
+            }
+
+            // e.g. set upscaling filter
+            if (strncmp(argv[i], "--filter", strlen("--filter")) == 0) {
+                static const char *filter_names[FILTER_COUNT] = {
+                    "rects", "nearest", "scale2x", "scale3x", "scale4x", "crt",
+                };
+                i++;
+                config->filter = FILTER_COUNT;
+                for (filter_t f = 0; f < FILTER_COUNT; f++)
+                    if (strcmp(argv[i], filter_names[f]) == 0) config->filter = f;
+
+                if (config->filter == FILTER_COUNT) {
+                    SDL_Log("Unknown --filter %s, expected rects, nearest, scale2x, scale3x, scale4x or crt\n", argv[i]);
+                    return false;
+                }
+            }
+
+            // e.g. count instructions & superinstructions
+            if (strncmp(argv[i], "--profile", strlen("--profile")) == 0) {
+                config->profile = true;
+            }
+
+            // e.g. export frames headless
+            if (strncmp(argv[i], "--export", strlen("--export")) == 0) {
+                i++;
+                config->export_file = argv[i];
+            }
+
+            // e.g. set export frame format
+            if (strncmp(argv[i], "--format", strlen("--format")) == 0) {
+                i++;
+                if (strcmp(argv[i], "y4m") == 0) {
+                    config->export_format = EXPORT_Y4M;
+                } else if (strcmp(argv[i], "rgba") == 0) {
+                    config->export_format = EXPORT_RGBA;
+                } else {
+                    SDL_Log("Unknown --format %s, expected y4m or rgba\n", argv[i]);
+                    return false;
+                }
+            }
+
+            // e.g. set number of frames to export
+            if (strncmp(argv[i], "--frames", strlen("--frames")) == 0) {
+                i++;
+                config->export_frames = (uint32_t)strtoul(argv[i], NULL, 10);
+            }
+
+            // e.g. write a PNG every N exported frames
+            if (strncmp(argv[i], "--png-every", strlen("--png-every")) == 0) {
+                i++;
+                config->png_every = (uint32_t)strtoul(argv[i], NULL, 10);
+            }
+
+            // e.g. set PNG file name prefix
+            if (strncmp(argv[i], "--png-prefix", strlen("--png-prefix")) == 0) {
+                i++;
+                config->png_prefix = argv[i];
+            }
+
+            // e.g. export audio as WAV
+            if (strncmp(argv[i], "--wav", strlen("--wav")) == 0) {
+                i++;
+                config->wav_file = argv[i];
+            }
+
+            // e.g. replay keypad input from a log
+            if (strncmp(argv[i], "--input", strlen("--input")) == 0) {
+                i++;
+                config->input_file = argv[i];
+            }
     }
 
     return true;    // Success
 }
 
-bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]) {
+// Reset the CHIP8 machine with a ROM image already in memory
+bool init_chip8_from_memory(chip8_t *chip8, const config_t config, const uint8_t rom[], const size_t rom_size) {
     const uint32_t entry_point = 0x200; // CHIP8 Roms will be loaded to 0x200
     const uint8_t font[] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0
@@ -59,12 +191,37 @@ bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]) {
         0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
     };
 
+    // Check rom size
+    const size_t max_size = sizeof chip8->ram - entry_point;
+    if (rom_size > max_size) {
+        SDL_Log("Rom is too big! Rom size: %llu, Max size allowed: %llu\n",
+                (long long unsigned)rom_size, (long long unsigned)max_size);
+        return false;
+    }
+
     // Initialize entire CHIP8 machine
     memset(chip8, 0, sizeof(chip8_t));
 
     // Load font
     memcpy(&chip8->ram[0], font, sizeof(font));
 
+    // Load ROM
+    memcpy(&chip8->ram[entry_point], rom, rom_size);
+
+    // Set chip8 machine defaults
+    chip8->PC = entry_point;    // Start program counter at ROM entry point
+    chip8->stack_ptr = &chip8->stack[0];
+    chip8->key_wait_key = 0xFF;         // FX0A not waiting on any key
+    chip8->rng = config.rng_seed ? config.rng_seed : 1; // xorshift32 state must be non-zero
+    chip8->pitch = 64;                  // XO-CHIP default pitch, 4000 pattern bits per second
+    memset(chip8->audio_pattern, 0xF0, sizeof chip8->audio_pattern);  // Default 500hz square wave
+
+    return true;    // Success
+}
+
+bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]) {
+    uint8_t data[sizeof chip8->ram - 0x200];    // Largest ROM that fits above the entry point
+
     // Open ROM file
     FILE *rom = fopen(rom_name, "rb");
     if (!rom) {
@@ -75,29 +232,26 @@ bool init_chip8(chip8_t *chip8, const config_t config, const char rom_name[]) {
     // Get/check rom size
     fseek(rom, 0, SEEK_END);
     const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof chip8->ram - entry_point;
     rewind(rom);
 
-    if (rom_size > max_size) {
+    if (rom_size > sizeof data) {
         SDL_Log("Rom file %s is too big! Rom size: %llu, Max size allowed: %llu\n",
-                rom_name, (long long unsigned)rom_size, (long long unsigned)max_size);
+                rom_name, (long long unsigned)rom_size, (long long unsigned)sizeof data);
+        fclose(rom);
         return false;
     }
 
-    // Load ROM
-    if (fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1) {
+    // Read ROM
+    if (rom_size > 0 && fread(data, rom_size, 1, rom) != 1) {
         SDL_Log("Could not read Rom file %s into CHIP8 memory\n",
                 rom_name);
+        fclose(rom);
         return false;
     }
     fclose(rom);
 
-    // Set chip8 machine defaults
-    chip8->state = RUNNING;     // Default machine state to on/running
-    chip8->PC = entry_point;    // Start program counter at ROM entry point
+    if (!init_chip8_from_memory(chip8, config, data, rom_size)) return false;
     chip8->rom_name = rom_name;
-    chip8->stack_ptr = &chip8->stack[0];
-    memset(&chip8->pixel_color[0], config.bg_color, sizeof chip8->pixel_color); // Init pixels to bg color
 
     return true;    // Success
 }
@@ -16,8 +16,56 @@ void clear_screen(const sdl_t sdl, const config_t config) {
     SDL_RenderClear(sdl.renderer);
 }
 
-// Update window with any changes
-void update_screen(const sdl_t sdl, const config_t config, chip8_t *chip8) {
+// Update window with any changes; the upscaling filter's cost is counted in profile, if not NULL
+void update_screen(const sdl_t sdl, const config_t config, const bool display[], uint32_t pixel_color[], profile_t *profile) {
+    const uint32_t num_pixels = config.window_width * config.window_height;
+
+    // Lerp each pixel's color towards fg_color if it's on, bg_color if it's off
+    for (uint32_t i = 0; i < num_pixels; i++) {
+        const uint32_t target_color = display[i] ? config.fg_color : config.bg_color;
+        if (pixel_color[i] != target_color)
+            pixel_color[i] = color_lerp(pixel_color[i], target_color, config.color_lerp_rate);
+    }
+
+    if (config.filter != FILTER_RECTS && sdl.textures[config.filter]) {
+        // Upscale pixel colors straight into the filter's streaming texture, then stretch it to the window
+        SDL_Texture *texture = sdl.textures[config.filter];
+        void *pixels;
+        int pitch;
+
+        // Stretch by a whole number so all pixels come out the same size, centered on a background
+        //   border if the scale factor is not a multiple of the filter's (e.g. scale3x at 20 is 6x).
+        //   A window smaller than the filter output gets it squeezed to fit instead.
+        const uint32_t scale = filter_scale(config.filter);
+        const uint32_t stretch = config.scale_factor / scale;
+        const uint32_t border = config.scale_factor - stretch * scale;  // Per CHIP8 pixel
+        const SDL_Rect dest = {
+            .x = config.window_width * border / 2,
+            .y = config.window_height * border / 2,
+            .w = config.window_width * scale * stretch,
+            .h = config.window_height * scale * stretch,
+        };
+
+        if (SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0) {
+            const uint64_t start = SDL_GetPerformanceCounter();
+            upscale(config.filter, pixel_color, config.window_width, config.window_height,
+                    pixels, pitch / sizeof(uint32_t));
+            if (profile) {
+                const uint64_t ticks = SDL_GetPerformanceCounter() - start;
+                profile->upscale_frames[config.filter]++;
+                profile->upscale_ticks[config.filter] += ticks;
+                if (ticks > profile->upscale_max_ticks[config.filter]) profile->upscale_max_ticks[config.filter] = ticks;
+            }
+            SDL_UnlockTexture(texture);
+
+            if (border && stretch) clear_screen(sdl, config);
+            SDL_RenderCopy(sdl.renderer, texture, NULL, stretch ? &dest : NULL);
+        }
+
+        SDL_RenderPresent(sdl.renderer);
+        return;
+    }
+
     SDL_Rect rect = {.x = 0, .y = 0, .w = config.scale_factor, .h = config.scale_factor};
 
     // Grab bg color values to draw outlines
@@ -27,89 +75,92 @@ void update_screen(const sdl_t sdl, const config_t config, chip8_t *chip8) {
     const uint8_t bg_a = (config.bg_color >>  0) & 0xFF;
 
     // Loop through display pixels, draw a rectangle per pixel to the SDL window
-    for (uint32_t i = 0; i < sizeof chip8->display; i++) {
+    for (uint32_t i = 0; i < num_pixels; i++) {
         // Translate 1D index i value to 2D X/Y coordinates
         // X = i % window width
         // Y = i / window width
         rect.x = (i % config.window_width) * config.scale_factor;
         rect.y = (i / config.window_width) * config.scale_factor;
 
-        if (chip8->display[i]) {
-            // Pixel is on, draw foreground color
-            if (chip8->pixel_color[i] != config.fg_color) {
-                // Lerp towards fg_color
-                chip8->pixel_color[i] = color_lerp(chip8->pixel_color[i],
-                                                   config.fg_color,
-                                                   config.color_lerp_rate);
-            }
-
-            const uint8_t r = (chip8->pixel_color[i] >> 24) & 0xFF;
-            const uint8_t g = (chip8->pixel_color[i] >> 16) & 0xFF;
-            const uint8_t b = (chip8->pixel_color[i] >>  8) & 0xFF;
-            const uint8_t a = (chip8->pixel_color[i] >>  0) & 0xFF;
-
-            SDL_SetRenderDrawColor(sdl.renderer, r, g, b, a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
+        const uint8_t r = (pixel_color[i] >> 24) & 0xFF;
+        const uint8_t g = (pixel_color[i] >> 16) & 0xFF;
+        const uint8_t b = (pixel_color[i] >>  8) & 0xFF;
+        const uint8_t a = (pixel_color[i] >>  0) & 0xFF;
 
-            // TODO: Move this outside if/else, and combine lerping or at least reduce duplicate code
-            if (config.pixel_outlines) {
-                // If user requested drawing pixel outlines, draw those here
-                SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-                SDL_RenderDrawRect(sdl.renderer, &rect);
-            }
-
-        } else {
-            // Pixel is off, draw background color
-            if (chip8->pixel_color[i] != config.bg_color) {
-                // Lerp towards bg_color
-                chip8->pixel_color[i] = color_lerp(chip8->pixel_color[i],
-                                                   config.bg_color,
-                                                   config.color_lerp_rate);
-            }
+        SDL_SetRenderDrawColor(sdl.renderer, r, g, b, a);
+        SDL_RenderFillRect(sdl.renderer, &rect);
 
-            const uint8_t r = (chip8->pixel_color[i] >> 24) & 0xFF;
-            const uint8_t g = (chip8->pixel_color[i] >> 16) & 0xFF;
-            const uint8_t b = (chip8->pixel_color[i] >>  8) & 0xFF;
-            const uint8_t a = (chip8->pixel_color[i] >>  0) & 0xFF;
-
-            SDL_SetRenderDrawColor(sdl.renderer, r, g, b, a);
-            SDL_RenderFillRect(sdl.renderer, &rect);
+        if (display[i] && config.pixel_outlines) {
+            // If user requested drawing pixel outlines, draw those around lit pixels
+            SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
+            SDL_RenderDrawRect(sdl.renderer, &rect);
         }
     }
 
     SDL_RenderPresent(sdl.renderer);
 }
 
-void handle_input(chip8_t *chip8, config_t *config) {
+// Map qwerty keys to CHIP8 keypad, returns the CHIP8 key 0x0-0xF or -1 if not a keypad key
+static int map_key(const SDL_Keycode key) {
+    switch (key) {
+        case SDLK_1: return 0x1;
+        case SDLK_2: return 0x2;
+        case SDLK_3: return 0x3;
+        case SDLK_4: return 0xC;
+
+        case SDLK_q: return 0x4;
+        case SDLK_w: return 0x5;
+        case SDLK_e: return 0x6;
+        case SDLK_r: return 0xD;
+
+        case SDLK_a: return 0x7;
+        case SDLK_s: return 0x8;
+        case SDLK_d: return 0x9;
+        case SDLK_f: return 0xE;
+
+        case SDLK_z: return 0xA;
+        case SDLK_x: return 0x0;
+        case SDLK_c: return 0xB;
+        case SDLK_v: return 0xF;
+
+        default: return -1;
+    }
+}
+
+// Handle input on the render thread; machine state changes are handed to the emulation
+//   thread through emu's atomics, the keypad is latched by it at the start of each frame
+void handle_input(emulator_t *emu, config_t *config, uint32_t pixel_color[]) {
     SDL_Event event;
+    int key;
 
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_QUIT:
                 // Exit window; End program
-                chip8->state = QUIT; // Will exit main emulator loop
+                SDL_AtomicSet(&emu->state, QUIT); // Will exit main emulator loop
                 break;
 
             case SDL_KEYDOWN:
                 switch (event.key.keysym.sym) {
                     case SDLK_ESCAPE:
                         // Escape key; Exit window & End program
-                        chip8->state = QUIT;
+                        SDL_AtomicSet(&emu->state, QUIT);
                         break;
 
                     case SDLK_SPACE:
-                        // Space bar
-                        if (chip8->state == RUNNING) {
-                            chip8->state = PAUSED;  // Pause
-                            puts("==== PAUSED ====");
+                        // Space bar; compare & swap so a quit earlier in this batch stays
+                        if (SDL_AtomicCAS(&emu->state, RUNNING, PAUSED)) {
+                            puts("==== PAUSED ====");  // Pause
                         } else {
-                            chip8->state = RUNNING; // Resume
+                            SDL_AtomicCAS(&emu->state, PAUSED, RUNNING);  // Resume
                         }
                         break;
 
                     case SDLK_EQUALS:
                         // '=': Reset CHIP8 machine for the current ROM
-                        init_chip8(chip8, *config, chip8->rom_name);
+                        SDL_AtomicSet(&emu->reset, 1);
+                        for (uint32_t i = 0; i < 64*32; i++)
+                            pixel_color[i] = config->bg_color;
                         break;
 
                     case SDLK_j:
@@ -124,69 +175,42 @@ void handle_input(chip8_t *chip8, config_t *config) {
                             config->color_lerp_rate += 0.1;
                         break;
 
+                    case SDLK_g:
+                        // 'g': Cycle upscaling filter
+                        config->filter = (config->filter + 1) % FILTER_COUNT;
+                        break;
+
                     case SDLK_o:
                         // 'o': Decrease Volume
                         if (config->volume > 0)
                             config->volume -= 500;
+                        SDL_AtomicSet(&emu->audio.volume, config->volume);
                         break;
 
                     case SDLK_p:
                         // 'p': Increase Volume
                         if (config->volume < INT16_MAX)
                             config->volume += 500;
+                        SDL_AtomicSet(&emu->audio.volume, config->volume);
                         break;
 
-                    // Map qwerty keys to CHIP8 keypad
-                    case SDLK_1: chip8->keypad[0x1] = true; break;
-                    case SDLK_2: chip8->keypad[0x2] = true; break;
-                    case SDLK_3: chip8->keypad[0x3] = true; break;
-                    case SDLK_4: chip8->keypad[0xC] = true; break;
-
-                    case SDLK_q: chip8->keypad[0x4] = true; break;
-                    case SDLK_w: chip8->keypad[0x5] = true; break;
-                    case SDLK_e: chip8->keypad[0x6] = true; break;
-                    case SDLK_r: chip8->keypad[0xD] = true; break;
-
-                    case SDLK_a: chip8->keypad[0x7] = true; break;
-                    case SDLK_s: chip8->keypad[0x8] = true; break;
-                    case SDLK_d: chip8->keypad[0x9] = true; break;
-                    case SDLK_f: chip8->keypad[0xE] = true; break;
-
-                    case SDLK_z: chip8->keypad[0xA] = true; break;
-                    case SDLK_x: chip8->keypad[0x0] = true; break;
-                    case SDLK_c: chip8->keypad[0xB] = true; break;
-                    case SDLK_v: chip8->keypad[0xF] = true; break;
-
-                    default: break;
-
+                    default:
+                        // Set CHIP8 keypad key; only this thread writes the keypad bits
+                        key = map_key(event.key.keysym.sym);
+                        if (key >= 0) {
+                            if (config->latency_file && !event.key.repeat)
+                                latency_keydown(&emu->latency, key);
+                            SDL_AtomicSet(&emu->keypad, SDL_AtomicGet(&emu->keypad) | (1 << key));
+                        }
+                        break;
                 }
                 break;
 
             case SDL_KEYUP:
-                switch (event.key.keysym.sym) {
-                    // Map qwerty keys to CHIP8 keypad
-                    case SDLK_1: chip8->keypad[0x1] = false; break;
-                    case SDLK_2: chip8->keypad[0x2] = false; break;
-                    case SDLK_3: chip8->keypad[0x3] = false; break;
-                    case SDLK_4: chip8->keypad[0xC] = false; break;
-
-                    case SDLK_q: chip8->keypad[0x4] = false; break;
-                    case SDLK_w: chip8->keypad[0x5] = false; break;
-                    case SDLK_e: chip8->keypad[0x6] = false; break;
-                    case SDLK_r: chip8->keypad[0xD] = false; break;
-
-                    case SDLK_a: chip8->keypad[0x7] = false; break;
-                    case SDLK_s: chip8->keypad[0x8] = false; break;
-                    case SDLK_d: chip8->keypad[0x9] = false; break;
-                    case SDLK_f: chip8->keypad[0xE] = false; break;
-
-                    case SDLK_z: chip8->keypad[0xA] = false; break;
-                    case SDLK_x: chip8->keypad[0x0] = false; break;
-                    case SDLK_c: chip8->keypad[0xB] = false; break;
-                    case SDLK_v: chip8->keypad[0xF] = false; break;
-
-                    default: break;
-                }
+                // Clear CHIP8 keypad key
+                key = map_key(event.key.keysym.sym);
+                if (key >= 0)
+                    SDL_AtomicSet(&emu->keypad, SDL_AtomicGet(&emu->keypad) & ~(1 << key));
                 break;
 
             default:
@@ -195,20 +219,184 @@ void handle_input(chip8_t *chip8, config_t *config) {
     }
 }
 
-// Emulate 1 CHIP8 instruction
-void emulate_instruction(chip8_t *chip8, const config_t config) {
-    bool carry;   // Save carry flag/VF value for some instructions
+// Approximate COSMAC VIP instruction costs in 1802 machine cycles (8 clocks each), excluding
+//   the fetch/decode overhead; indexed by the opcode's first nibble. Opcodes whose cost depends
+//   on operands or on whether a skip was taken are adjusted in instruction_cycles().
+#define VIP_CYCLES_PER_SECOND (1760900 / 8)
+#define VIP_FETCH_CYCLES 40
+static const uint8_t vip_cycles[16] = {
+    24,     // 0x00E0/0x00EE
+    12,     // 0x1NNN
+    26,     // 0x2NNN
+    10,     // 0x3XNN
+    10,     // 0x4XNN
+    14,     // 0x5XY0
+    6,      // 0x6XNN
+    10,     // 0x7XNN
+    44,     // 0x8XYN
+    14,     // 0x9XY0
+    12,     // 0xANNN
+    22,     // 0xBNNN
+    36,     // 0xCXNN
+    26,     // 0xDXYN, plus per row cost
+    14,     // 0xEXNN
+    10,     // 0xFXNN, some have extra cost
+};
+
+// Virtual clock rate for the configured timing profile
+uint32_t cycles_per_second(const config_t config) {
+    return config.timing == TIMING_VIP ? VIP_CYCLES_PER_SECOND : config.insts_per_second;
+}
 
-    // Get next opcode from ram
-    chip8->inst.opcode = (chip8->ram[chip8->PC] << 8) | chip8->ram[chip8->PC+1];
-    chip8->PC += 2; // Pre-increment program counter for next opcode
+// Cycle at which the current 60hz frame ends, and the delay & sound timers tick
+uint64_t next_frame_cycle(const chip8_t *chip8, const config_t config) {
+    return (chip8->frames + 1) * cycles_per_second(config) / 60;
+}
+
+// Cost of the instruction just executed in chip8->inst under the timing profile, in virtual
+//   clock cycles; display wait not included
+static uint32_t timing_cycles(const chip8_t *chip8, const config_t config, const bool skipped) {
+    if (config.timing == TIMING_FAST) return 1;
+
+    uint32_t cycles = VIP_FETCH_CYCLES + vip_cycles[chip8->inst.opcode >> 12];
+    if (skipped) cycles += 4;
+
+    switch (chip8->inst.opcode >> 12) {
+        case 0x0D:
+            // Each sprite row is shifted into place byte by byte, more so if X is not byte aligned;
+            //   VX as it was before the draw, with DXYN VF is now the collision flag
+            cycles += chip8->inst.N * ((chip8->draw_x % 8) ? 68 : 46);
+            break;
+
+        case 0x0F:
+            switch (chip8->inst.NN) {
+                case 0x0A: cycles += 8; break;
+                case 0x1E: cycles += 6; break;
+                case 0x29: cycles += 6; break;
+                case 0x33: cycles += 74 + 16 * (chip8->ram[chip8->I] + chip8->ram[chip8->I+1] + chip8->ram[chip8->I+2]); break;
+                case 0x55:
+                case 0x65: cycles += 4 + 14 * (chip8->inst.X + 1); break;
+                default: break;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return cycles;
+}
+
+// Cost of the instruction just executed in chip8->inst, in virtual clock cycles
+static uint64_t instruction_cycles(const chip8_t *chip8, const config_t config, const bool skipped) {
+    const uint64_t cycles = timing_cycles(chip8, config, skipped);
+
+    // Display wait: on CHIP8 a draw waits for the next 60hz vertical blank interrupt, then
+    //   draws; whatever the draw costs past the interrupt comes out of the next frame
+    if ((config.current_extension == CHIP8) && (chip8->inst.opcode >> 12 == 0xD)) {
+        const uint64_t frame_end = next_frame_cycle(chip8, config);
+        return (chip8->cycles < frame_end ? frame_end - chip8->cycles : 0) + cycles;
+    }
 
-    // Fill out current instruction format
-    chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
-    chip8->inst.NN = chip8->inst.opcode & 0x0FF;
-    chip8->inst.N = chip8->inst.opcode & 0x0F;
-    chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-    chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
+    return cycles;
+}
+
+// Fill out instruction format from the opcode at address in ram
+static void decode_instruction(const chip8_t *chip8, const uint16_t address, instruction_t *inst) {
+    inst->opcode = (chip8->ram[address] << 8) | chip8->ram[address+1];
+    inst->NNN = inst->opcode & 0x0FFF;
+    inst->NN = inst->opcode & 0x0FF;
+    inst->N = inst->opcode & 0x0F;
+    inst->X = (inst->opcode >> 8) & 0x0F;
+    inst->Y = (inst->opcode >> 4) & 0x0F;
+}
+
+// Drop decode cache entries for instructions overlapping ram written at address..address+length-1;
+//   breakpoints stay patched in
+void invalidate_decoded(chip8_t *chip8, const uint16_t address, const uint16_t length) {
+    for (uint16_t i = address - (DECODE_SPAN - 1); i != (uint16_t)(address + length); i++)
+        if (chip8->decoded[i & 0x0FFF].kind == DECODE_VALID)
+            chip8->decoded[i & 0x0FFF].kind = DECODE_EMPTY;
+}
+
+// 0xDXYN: XOR an N row sprite from ram at I onto the display at VX,VY, VF = collision
+static void draw_sprite(chip8_t *chip8, const config_t config) {
+    uint8_t X_coord = chip8->V[chip8->inst.X] % config.window_width;
+    uint8_t Y_coord = chip8->V[chip8->inst.Y] % config.window_height;
+    const uint8_t orig_X = X_coord; // Original X value
+
+    chip8->draw_x = chip8->V[chip8->inst.X];
+    chip8->V[0xF] = 0;  // Initialize carry flag to 0
+
+    // Loop over all N rows of the sprite
+    for (uint8_t i = 0; i < chip8->inst.N; i++) {
+        // Get next byte/row of sprite data
+        const uint8_t sprite_data = chip8->ram[chip8->I + i];
+        X_coord = orig_X;   // Reset X for next row to draw
+
+        for (int8_t j = 7; j >= 0; j--) {
+            // If sprite pixel/bit is on and display pixel is on, set carry flag
+            bool *pixel = &chip8->display[Y_coord * config.window_width + X_coord];
+            const bool sprite_bit = (sprite_data & (1 << j));
+
+            if (sprite_bit && *pixel) {
+                chip8->V[0xF] = 1;
+            }
+
+            // XOR display pixel with sprite pixel/bit to set it on or off
+            *pixel ^= sprite_bit;
+
+            // Stop drawing this row if hit right edge of screen
+            if (++X_coord >= config.window_width) break;
+        }
+
+        // Stop drawing entire sprite if hit bottom edge of screen
+        if (++Y_coord >= config.window_height) break;
+    }
+    chip8->draw = true; // Will update screen on next 60hz tick
+    if (chip8->latency) latency_draw(chip8->latency);
+}
+
+// 0xFX33: Store VX as 3 BCD digits at ram I..I+2
+static void store_bcd(chip8_t *chip8) {
+    uint8_t bcd = chip8->V[chip8->inst.X];
+    chip8->ram[chip8->I+2] = bcd % 10;
+    bcd /= 10;
+    chip8->ram[chip8->I+1] = bcd % 10;
+    bcd /= 10;
+    chip8->ram[chip8->I] = bcd;
+    invalidate_decoded(chip8, chip8->I, 3);
+}
+
+// 0xFX65: Load V0-VX from ram at I
+static void load_registers(chip8_t *chip8, const config_t config) {
+    for (uint8_t i = 0; i <= chip8->inst.X; i++) {
+        if (config.current_extension == CHIP8)
+            chip8->V[i] = chip8->ram[chip8->I++]; // Increment I each time
+        else
+            chip8->V[i] = chip8->ram[chip8->I + i];
+    }
+}
+
+// Finish the instruction in chip8->inst, fetched from start_PC: advance the virtual clock,
+//   then trace & profile it
+static inline void retire_instruction(chip8_t *chip8, const config_t config, const uint16_t start_PC) {
+    // Only the conditional skips can move PC past the next instruction without a jump;
+    //   a 1NNN/2NNN/BNNN landing on start_PC + 4 is not a skip
+    const uint8_t kind = chip8->inst.opcode >> 12;
+    const bool skip_opcode = kind == 0x3 || kind == 0x4 || kind == 0x5 || kind == 0x9 || kind == 0xE;
+    const bool skipped = skip_opcode && chip8->PC != (uint16_t)(start_PC + 2);
+
+    chip8->cycles += instruction_cycles(chip8, config, skipped);
+
+    // Execution trace & profile; when disabled they only cost these checks
+    if (chip8->trace) trace_instruction(chip8->trace, chip8, start_PC);
+    if (chip8->profile) chip8->profile->instructions++;
+}
+
+// Execute the instruction in chip8->inst, fetched from start_PC; PC already points past it
+static void execute_instruction(chip8_t *chip8, const config_t config, const uint16_t start_PC) {
+    bool carry;   // Save carry flag/VF value for some instructions
 
     // Emulate opcode
     switch ((chip8->inst.opcode >> 12) & 0x0F) {
@@ -377,48 +565,21 @@ void emulate_instruction(chip8_t *chip8, const config_t config) {
 
         case 0x0C:
             // 0xCXNN: Sets register VX = rand() % 256 & NN (bitwise AND)
-            chip8->V[chip8->inst.X] = (rand() % 256) & chip8->inst.NN;
+            // Uses a per-machine xorshift32 generator instead of rand() so the result is part of
+            //   the machine state, and restoring a snapshot replays the same numbers
+            chip8->rng ^= chip8->rng << 13;
+            chip8->rng ^= chip8->rng >> 17;
+            chip8->rng ^= chip8->rng << 5;
+            chip8->V[chip8->inst.X] = (chip8->rng >> 24) & chip8->inst.NN;
             break;
 
-        case 0x0D: {
+        case 0x0D:
             // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
             //   Screen pixels are XOR'd with sprite bits,
             //   VF (Carry flag) is set if any screen pixels are set off; This is useful
             //   for collision detection or other reasons.
-            uint8_t X_coord = chip8->V[chip8->inst.X] % config.window_width;
-            uint8_t Y_coord = chip8->V[chip8->inst.Y] % config.window_height;
-            const uint8_t orig_X = X_coord; // Original X value
-
-            chip8->V[0xF] = 0;  // Initialize carry flag to 0
-
-            // Loop over all N rows of the sprite
-            for (uint8_t i = 0; i < chip8->inst.N; i++) {
-                // Get next byte/row of sprite data
-                const uint8_t sprite_data = chip8->ram[chip8->I + i];
-                X_coord = orig_X;   // Reset X for next row to draw
-
-                for (int8_t j = 7; j >= 0; j--) {
-                    // If sprite pixel/bit is on and display pixel is on, set carry flag
-                    bool *pixel = &chip8->display[Y_coord * config.window_width + X_coord];
-                    const bool sprite_bit = (sprite_data & (1 << j));
-
-                    if (sprite_bit && *pixel) {
-                        chip8->V[0xF] = 1;
-                    }
-
-                    // XOR display pixel with sprite pixel/bit to set it on or off
-                    *pixel ^= sprite_bit;
-
-                    // Stop drawing this row if hit right edge of screen
-                    if (++X_coord >= config.window_width) break;
-                }
-
-                // Stop drawing entire sprite if hit bottom edge of screen
-                if (++Y_coord >= config.window_height) break;
-            }
-            chip8->draw = true; // Will update screen on next 60hz tick
+            draw_sprite(chip8, config);
             break;
-        }
 
         case 0x0E:
             if (chip8->inst.NN == 0x9E) {
@@ -430,33 +591,38 @@ void emulate_instruction(chip8_t *chip8, const config_t config) {
                 // 0xEX9E: Skip next instruction if key in VX is not pressed
                 if (!chip8->keypad[chip8->V[chip8->inst.X]])
                     chip8->PC += 2;
+
+            } else {
+                break;
             }
+
+            if (chip8->latency && chip8->keypad[chip8->V[chip8->inst.X]])
+                latency_observe(chip8->latency, chip8->V[chip8->inst.X]);
             break;
 
         case 0x0F:
             switch (chip8->inst.NN) {
                 case 0x0A: {
                     // 0xFX0A: VX = get_key(); Await until a keypress, and store in VX
-                    static bool any_key_pressed = false;
-                    static uint8_t key = 0xFF;
-
-                    for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keypad; i++)
+                    // Wait state is kept in chip8_t (not function statics) so state snapshots capture it
+                    for (uint8_t i = 0; chip8->key_wait_key == 0xFF && i < sizeof chip8->keypad; i++)
                         if (chip8->keypad[i]) {
-                            key = i;    // Save pressed key to check until it is released
-                            any_key_pressed = true;
+                            chip8->key_wait_key = i;    // Save pressed key to check until it is released
+                            chip8->key_wait_pressed = true;
+                            if (chip8->latency) latency_observe(chip8->latency, i);
                             break;
                         }
 
                     // If no key has been pressed yet, keep getting the current opcode & running this instruction
-                    if (!any_key_pressed) chip8->PC -= 2;
+                    if (!chip8->key_wait_pressed) chip8->PC -= 2;
                     else {
                         // A key has been pressed, also wait until it is released to set the key in VX
-                        if (chip8->keypad[key])     // "Busy loop" CHIP8 emulation until key is released
+                        if (chip8->keypad[chip8->key_wait_key])  // "Busy loop" CHIP8 emulation until key is released
                             chip8->PC -= 2;
                         else {
-                            chip8->V[chip8->inst.X] = key;     // VX = key
-                            key = 0xFF;                        // Reset key to not found
-                            any_key_pressed = false;           // Reset to nothing pressed yet
+                            chip8->V[chip8->inst.X] = chip8->key_wait_key; // VX = key
+                            chip8->key_wait_key = 0xFF;                    // Reset key to not found
+                            chip8->key_wait_pressed = false;               // Reset to nothing pressed yet
                         }
                     }
                     break;
@@ -479,29 +645,40 @@ void emulate_instruction(chip8_t *chip8, const config_t config) {
 
                 case 0x18:
                     // 0xFX18: sound timer = VX
+                    render_audio(chip8, config);    // Tone starts/stops on this sample
                     chip8->sound_timer = chip8->V[chip8->inst.X];
                     break;
 
+                case 0x02:
+                    // 0xF002: XO-CHIP: Load 16 byte audio pattern buffer from memory offset from I
+                    if (config.current_extension != XOCHIP || chip8->inst.X != 0) break;
+                    render_audio(chip8, config);
+                    for (uint8_t i = 0; i < sizeof chip8->audio_pattern; i++)
+                        chip8->audio_pattern[i] = chip8->ram[(chip8->I + i) & 0x0FFF];
+                    break;
+
+                case 0x3A:
+                    // 0xFX3A: XO-CHIP: Set audio pattern playback pitch = VX
+                    if (config.current_extension != XOCHIP) break;
+                    render_audio(chip8, config);
+                    chip8->pitch = chip8->V[chip8->inst.X];
+                    break;
+
                 case 0x29:
                     // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
                     chip8->I = chip8->V[chip8->inst.X] * 5;
                     break;
 
-                case 0x33: {
+                case 0x33:
                     // 0xFX33: Store BCD representation of VX at memory offset from I;
                     //   I = hundred's place, I+1 = ten's place, I+2 = one's place
-                    uint8_t bcd = chip8->V[chip8->inst.X];
-                    chip8->ram[chip8->I+2] = bcd % 10;
-                    bcd /= 10;
-                    chip8->ram[chip8->I+1] = bcd % 10;
-                    bcd /= 10;
-                    chip8->ram[chip8->I] = bcd;
+                    store_bcd(chip8);
                     break;
-                }
 
                 case 0x55:
                     // 0xFX55: Register dump V0-VX inclusive to memory offset from I;
                     //   SCHIP does not increment I, CHIP8 does increment I
+                    invalidate_decoded(chip8, chip8->I, chip8->inst.X + 1);
                     for (uint8_t i = 0; i <= chip8->inst.X; i++)  {
                         if (config.current_extension == CHIP8)
                             chip8->ram[chip8->I++] = chip8->V[i]; // Increment I each time
@@ -513,12 +690,7 @@ void emulate_instruction(chip8_t *chip8, const config_t config) {
                 case 0x65:
                     // 0xFX65: Register load V0-VX inclusive from memory offset from I;
                     //   SCHIP does not increment I, CHIP8 does increment I
-                    for (uint8_t i = 0; i <= chip8->inst.X; i++) {
-                        if (config.current_extension == CHIP8)
-                            chip8->V[i] = chip8->ram[chip8->I++]; // Increment I each time
-                        else
-                            chip8->V[i] = chip8->ram[chip8->I + i];
-                    }
+                    load_registers(chip8, config);
                     break;
 
                 default:
@@ -529,17 +701,257 @@ void emulate_instruction(chip8_t *chip8, const config_t config) {
         default:
             break;  // Unimplemented or invalid opcode
     }
+
+    retire_instruction(chip8, config, start_PC);
+}
+
+// Emulate 1 CHIP8 instruction; reference interpreter, fetches & decodes straight from ram
+void emulate_instruction(chip8_t *chip8, const config_t config) {
+    const uint16_t start_PC = chip8->PC;
+
+    // Get next opcode from ram
+    decode_instruction(chip8, chip8->PC, &chip8->inst);
+    chip8->PC += 2; // Pre-increment program counter for next opcode
+
+    execute_instruction(chip8, config, start_PC);
+}
+
+static void decode_entry(chip8_t *chip8, const uint16_t address, decoded_t *entry);
+
+// Peephole fusion: does the instruction at address start a superinstruction with the ones after it.
+//   The following instructions get their own cache entries too, so a jump into the middle of a
+//   sequence just runs them one by one.
+static fusion_t fuse_instructions(chip8_t *chip8, const uint16_t address, const instruction_t *inst) {
+    if (address > sizeof chip8->ram - DECODE_SPAN) return FUSION_NONE;
+
+    const uint16_t next = (chip8->ram[address+2] << 8) | chip8->ram[address+3];
+    const uint16_t third = (chip8->ram[address+4] << 8) | chip8->ram[address+5];
+    fusion_t fusion = FUSION_NONE;
+    uint8_t length = 2;
+
+    if ((inst->opcode >> 12) == 0xA && (next >> 12) == 0xD) {
+        fusion = FUSION_DRAW;
+    } else if ((inst->opcode & 0xF0FF) == 0xF007 && next == (0x3000 | inst->X << 8) &&
+               third == (0x1000 | address)) {
+        fusion = FUSION_TIMER_WAIT;
+        length = 3;
+    } else if ((inst->opcode >> 12) == 0x6 && (next & 0xF00F) == 0x8004 &&
+               ((next >> 4) & 0x0F) == inst->X) {
+        fusion = FUSION_ADD;
+    } else if ((inst->opcode & 0xF0FF) == 0xF033 && (next & 0xF0FF) == 0xF065) {
+        fusion = FUSION_BCD_LOAD;
+    }
+
+    if (fusion == FUSION_NONE) return FUSION_NONE;
+
+    // Breakpoints inside the sequence are only honoured one by one
+    for (uint8_t i = 1; i < length; i++) {
+        decoded_t *part = &chip8->decoded[address + 2*i];
+        if (part->kind == DECODE_BREAK) return FUSION_NONE;
+        if (part->kind == DECODE_EMPTY) decode_entry(chip8, address + 2*i, part);
+    }
+
+    return fusion;
+}
+
+// Fill out a decode cache entry from the opcode(s) at address in ram
+static void decode_entry(chip8_t *chip8, const uint16_t address, decoded_t *entry) {
+    decode_instruction(chip8, address, &entry->inst);
+    entry->kind = DECODE_VALID;
+    entry->fusion = fuse_instructions(chip8, address, &entry->inst);
+}
+
+// Emulate 1 CHIP8 instruction using the decode cache.
+//   Breakpoints are patched into the cache, so they cost nothing extra on this path.
+// Returns false without executing anything if the instruction at PC has a breakpoint
+bool emulate_cached_instruction(chip8_t *chip8, const config_t config) {
+    decoded_t *entry = &chip8->decoded[chip8->PC & 0x0FFF];
+
+    if (entry->kind != DECODE_VALID) {
+        if (entry->kind == DECODE_BREAK) return false;
+        decode_entry(chip8, chip8->PC & 0x0FFF, entry);
+    }
+
+    const uint16_t start_PC = chip8->PC;
+    chip8->inst = entry->inst;
+    chip8->PC += 2; // Pre-increment program counter for next opcode
+
+    execute_instruction(chip8, config, start_PC);
+    return true;
+}
+
+// Would the next instruction of a superinstruction run right away if run one by one: the frame
+//   has not ended, and its cache entry is not a breakpoint or overwritten by the ones before it
+static inline bool fusion_continues(const chip8_t *chip8, const uint64_t frame_end) {
+    return chip8->cycles < frame_end && chip8->decoded[chip8->PC & 0x0FFF].kind == DECODE_VALID;
+}
+
+// Fetch the next instruction of a superinstruction from its cache entry, returns its address
+static inline uint16_t fetch_fused(chip8_t *chip8) {
+    const uint16_t PC = chip8->PC;
+    chip8->inst = chip8->decoded[PC & 0x0FFF].inst;
+    chip8->PC += 2;
+    return PC;
+}
+
+// Emulate the instruction at PC, or the superinstruction starting there, up to frame_end.
+//   Each instruction of a superinstruction still retires on its own, so the virtual clock, trace
+//   and VF/I quirks are exactly as if run one by one; only the cache lookup & dispatch are shared.
+// Returns false without executing anything if the instruction at PC has a breakpoint
+static inline bool emulate_fused_instruction(chip8_t *chip8, const config_t config, const uint64_t frame_end) {
+    decoded_t *entry = &chip8->decoded[chip8->PC & 0x0FFF];
+
+    if (entry->kind != DECODE_VALID) {
+        if (entry->kind == DECODE_BREAK) return false;
+        decode_entry(chip8, chip8->PC & 0x0FFF, entry);
+    }
+
+    const uint16_t start_PC = chip8->PC;
+    const uint64_t start_cycles = chip8->cycles;
+    uint16_t PC;
+    bool carry;
+
+    chip8->inst = entry->inst;
+    chip8->PC += 2;
+
+    switch (entry->fusion) {
+        case FUSION_DRAW:
+            // 0xANNN, 0xDXYN
+            chip8->I = chip8->inst.NNN;
+            retire_instruction(chip8, config, start_PC);
+            if (!fusion_continues(chip8, frame_end)) break;
+
+            PC = fetch_fused(chip8);
+            draw_sprite(chip8, config);
+            retire_instruction(chip8, config, PC);
+            if (chip8->profile) chip8->profile->fusions[FUSION_DRAW]++;
+            break;
+
+        case FUSION_TIMER_WAIT:
+            // 0xFX07, 0x3X00, 0x1NNN with NNN = the FX07
+            chip8->V[chip8->inst.X] = chip8->delay_timer;
+            retire_instruction(chip8, config, start_PC);
+            if (!fusion_continues(chip8, frame_end)) break;
+
+            PC = fetch_fused(chip8);
+            if (chip8->V[chip8->inst.X] == 0) chip8->PC += 2;
+            retire_instruction(chip8, config, PC);
+            if (chip8->PC != start_PC + 4 || !fusion_continues(chip8, frame_end)) break;
+
+            PC = fetch_fused(chip8);
+            chip8->PC = chip8->inst.NNN;
+            retire_instruction(chip8, config, PC);
+            if (chip8->profile) chip8->profile->fusions[FUSION_TIMER_WAIT]++;
+
+            // The delay timer only changes at the frame boundary, so every iteration until then is the
+            //   same. Skip over all the whole ones that finish before it; traces need each one.
+            if (!chip8->trace && chip8->cycles < frame_end) {
+                const uint64_t iteration = chip8->cycles - start_cycles;
+                const uint64_t skip = (frame_end - 1 - chip8->cycles) / iteration;
+                chip8->cycles += skip * iteration;
+                if (chip8->profile) {
+                    chip8->profile->instructions += 3 * skip;
+                    chip8->profile->skipped_waits += skip;
+                }
+            }
+            break;
+
+        case FUSION_ADD:
+            // 0x6YNN, 0x8XY4
+            chip8->V[chip8->inst.X] = chip8->inst.NN;
+            retire_instruction(chip8, config, start_PC);
+            if (!fusion_continues(chip8, frame_end)) break;
+
+            PC = fetch_fused(chip8);
+            carry = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
+            chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
+            chip8->V[0xF] = carry;
+            retire_instruction(chip8, config, PC);
+            if (chip8->profile) chip8->profile->fusions[FUSION_ADD]++;
+            break;
+
+        case FUSION_BCD_LOAD:
+            // 0xFX33, 0xFX65; the BCD store may overwrite the FX65, fusion_continues() catches that
+            store_bcd(chip8);
+            retire_instruction(chip8, config, start_PC);
+            if (!fusion_continues(chip8, frame_end)) break;
+
+            PC = fetch_fused(chip8);
+            load_registers(chip8, config);
+            retire_instruction(chip8, config, PC);
+            if (chip8->profile) chip8->profile->fusions[FUSION_BCD_LOAD]++;
+            break;
+
+        default:
+            execute_instruction(chip8, config, start_PC);
+            break;
+    }
+
+    return true;
+}
+
+// One step of emulate_frame(): the instruction or superinstruction at PC, fused no further than
+//   frame_end. For callers that look at the machine between steps, e.g. the fuzzer.
+// Returns false without executing anything at a breakpoint
+bool emulate_fused_step(chip8_t *chip8, const config_t config, const uint64_t frame_end) {
+    return emulate_fused_instruction(chip8, config, frame_end);
+}
+
+// Emulate CHIP8 Instructions for one emulator "frame" (60hz), i.e. until the virtual clock
+//   reaches the next frame boundary, then tick the delay & sound timers
+// Returns false if stopped at a breakpoint, calling again continues the same frame
+bool emulate_frame(chip8_t *chip8, const config_t config) {
+    const uint64_t frame_end = next_frame_cycle(chip8, config);
+
+    while (chip8->cycles < frame_end)
+        if (!emulate_fused_instruction(chip8, config, frame_end)) return false;
+
+    end_frame(chip8, config);
+    return true;
+}
+
+// Frame boundary reached: finish the frame's audio and tick the timers
+void end_frame(chip8_t *chip8, const config_t config) {
+    render_audio(chip8, config);    // Samples up to the timer tick, with the sound timer's old value
+    chip8->frames++;
+    update_timers(chip8);
 }
 
 // Update CHIP8 delay and sound timers every 60hz
-void update_timers(const sdl_t sdl, chip8_t *chip8) {
+void update_timers(chip8_t *chip8) {
     if (chip8->delay_timer > 0)
         chip8->delay_timer--;
 
-    if (chip8->sound_timer > 0) {
+    if (chip8->sound_timer > 0)
         chip8->sound_timer--;
-        SDL_PauseAudioDevice(sdl.dev, 0); // Play sound
-    } else {
-        SDL_PauseAudioDevice(sdl.dev, 1); // Pause sound
+}
+
+// Print instruction profile counters: how often each superinstruction ran
+void report_profile(const profile_t *profile) {
+    static const char *fusion_names[FUSION_COUNT] = {
+        [FUSION_DRAW] = "ANNN+DXYN draw",
+        [FUSION_TIMER_WAIT] = "FX07+3X00+1NNN timer wait",
+        [FUSION_ADD] = "6YNN+8XY4 add",
+        [FUSION_BCD_LOAD] = "FX33+FX65 BCD load",
+    };
+
+    SDL_Log("Profile: %llu instructions retired\n", (long long unsigned)profile->instructions);
+    for (fusion_t f = FUSION_NONE + 1; f < FUSION_COUNT; f++)
+        SDL_Log("  %-26s %llu\n", fusion_names[f], (long long unsigned)profile->fusions[f]);
+    SDL_Log("  Timer wait iterations skipped %llu\n", (long long unsigned)profile->skipped_waits);
+
+    // Upscaling filters used while running, by their cost per frame
+    static const char *filter_names[FILTER_COUNT] = {
+        [FILTER_NEAREST] = "nearest", [FILTER_SCALE2X] = "scale2x", [FILTER_SCALE3X] = "scale3x",
+        [FILTER_SCALE4X] = "scale4x", [FILTER_CRT] = "crt",
+    };
+    const double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+
+    for (filter_t f = FILTER_NEAREST; f < FILTER_COUNT; f++) {
+        if (profile->upscale_frames[f] == 0) continue;
+        SDL_Log("  Upscale %-8s %llu frames, avg %.3fms, max %.3fms\n", filter_names[f],
+                (long long unsigned)profile->upscale_frames[f],
+                profile->upscale_ticks[f] * ms_per_tick / profile->upscale_frames[f],
+                profile->upscale_max_ticks[f] * ms_per_tick);
     }
 }
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+// Why emulation stopped mid-frame
+typedef enum {
+    STOP_NONE,          // Frame completed
+    STOP_BREAKPOINT,    // At a patched decode cache entry, instruction not executed yet
+    STOP_WATCHPOINT,    // Right after the instruction that wrote a watched value
+} stop_t;
+
+// Registers & ram an instruction stored to, whether or not that changed their value
+typedef struct {
+    uint16_t V;             // Bitmask of data registers
+    bool I;
+    uint16_t ram;           // Ram written at ram..ram+ram_length-1
+    uint16_t ram_length;
+} writes_t;
+
+static uint32_t stack_depth(const chip8_t *chip8) {
+    return chip8->stack_ptr - chip8->stack;
+}
+
+static bool is_breakpoint(const debugger_t *debugger, const uint16_t address) {
+    for (uint32_t i = 0; i < debugger->num_breakpoints; i++)
+        if (debugger->breakpoints[i] == address) return true;
+    return false;
+}
+
+// Patch all breakpoints into the decode cache, e.g. after the machine was reset
+void apply_breakpoints(const debugger_t *debugger, chip8_t *chip8) {
+    for (uint32_t i = 0; i < debugger->num_breakpoints; i++)
+        chip8->decoded[debugger->breakpoints[i]].kind = DECODE_BREAK;
+
+    if (debugger->step_over_address >= 0)
+        chip8->decoded[debugger->step_over_address].kind = DECODE_BREAK;
+}
+
+// Un-patch a decode cache entry, unless another breakpoint still needs it
+static void clear_breakpoint(const debugger_t *debugger, chip8_t *chip8, const uint16_t address) {
+    if (is_breakpoint(debugger, address) || debugger->step_over_address == address) return;
+    chip8->decoded[address].kind = DECODE_EMPTY;  // Decoded again from ram on next use
+}
+
+static uint16_t read_watch(const chip8_t *chip8, const watchpoint_t *watch) {
+    switch (watch->type) {
+        case WATCH_RAM: return chip8->ram[watch->address];
+        case WATCH_I:   return chip8->I;
+        case WATCH_V:   return chip8->V[watch->address];
+        default:        return 0;
+    }
+}
+
+static void print_watch(const watchpoint_t *watch) {
+    switch (watch->type) {
+        case WATCH_RAM: printf("ram[0x%03X]", watch->address); break;
+        case WATCH_I:   printf("I"); break;
+        case WATCH_V:   printf("V%X", watch->address); break;
+        default: break;
+    }
+}
+
+static void print_location(const chip8_t *chip8) {
+    const uint16_t PC = chip8->PC & 0x0FFF;
+    printf("PC=0x%03X: %02X%02X\n", PC, chip8->ram[PC], chip8->ram[(PC + 1) & 0x0FFF]);
+}
+
+static void print_registers(const chip8_t *chip8) {
+    for (uint8_t i = 0; i < 16; i++)
+        printf("V%X=%02X%s", i, chip8->V[i], (i % 8 == 7) ? "\n" : " ");
+    printf("I=0x%03X DT=%u ST=%u SP=%u cycles=%llu frames=%llu\n",
+           chip8->I, chip8->delay_timer, chip8->sound_timer, stack_depth(chip8),
+           (long long unsigned)chip8->cycles, (long long unsigned)chip8->frames);
+    print_location(chip8);
+}
+
+static void print_stack(const chip8_t *chip8) {
+    if (stack_depth(chip8) == 0) puts("Stack is empty");
+    for (uint32_t i = stack_depth(chip8); i > 0; i--)
+        printf("#%u: return to 0x%03X\n", i - 1, chip8->stack[i - 1]);
+}
+
+static void print_memory(const chip8_t *chip8, const uint16_t address, const uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        const uint16_t a = (address + i) & 0x0FFF;
+        if (i % 16 == 0) printf("%s0x%03X:", i ? "\n" : "", a);
+        printf(" %02X", chip8->ram[a]);
+    }
+    printf("\n");
+}
+
+// What the instruction just executed in chip8->inst, fetched from PC with I as it was before,
+//   stored to. Mirrors the opcode paths in execute_instruction() that write V, I or ram.
+static writes_t instruction_writes(const chip8_t *chip8, const config_t config, const uint16_t PC, const uint16_t I) {
+    const instruction_t *inst = &chip8->inst;
+    const uint16_t VX = 1 << inst->X, VF = 1 << 0xF;
+    writes_t writes = {0};
+
+    switch (inst->opcode >> 12) {
+        case 0x6: case 0x7: case 0xC:
+            writes.V = VX;
+            break;
+
+        case 0x8:
+            if (inst->N == 0) writes.V = VX;
+            else if (inst->N <= 3) writes.V = VX | (config.current_extension == CHIP8 ? VF : 0);
+            else if (inst->N <= 7 || inst->N == 0xE) writes.V = VX | VF;
+            break;
+
+        case 0xA:
+            writes.I = true;
+            break;
+
+        case 0xD:
+            writes.V = VF;
+            break;
+
+        case 0xF:
+            switch (inst->NN) {
+                case 0x07: writes.V = VX; break;
+                case 0x0A: if (chip8->PC != PC) writes.V = VX; break;  // Only once the key is released
+                case 0x1E: case 0x29: writes.I = true; break;
+                case 0x33: writes.ram = I; writes.ram_length = 3; break;
+                case 0x55:
+                    writes.ram = I;
+                    writes.ram_length = inst->X + 1;
+                    writes.I = config.current_extension == CHIP8;
+                    break;
+                case 0x65:
+                    writes.V = (uint16_t)((2 << inst->X) - 1);  // V0-VX
+                    writes.I = config.current_extension == CHIP8;
+                    break;
+                default: break;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return writes;
+}
+
+static bool writes_watch(const writes_t *writes, const watchpoint_t *watch) {
+    switch (watch->type) {
+        case WATCH_RAM: return watch->address >= writes->ram && watch->address < writes->ram + writes->ram_length;
+        case WATCH_I:   return writes->I;
+        case WATCH_V:   return (writes->V >> watch->address) & 1;
+        default:        return false;
+    }
+}
+
+// Remember watched values before an instruction, to report what it changed
+static void read_watchpoints(debugger_t *debugger, const chip8_t *chip8) {
+    for (uint32_t i = 0; i < debugger->num_watchpoints; i++)
+        debugger->watchpoints[i].value = read_watch(chip8, &debugger->watchpoints[i]);
+}
+
+// Did the instruction just executed, fetched from PC with I as it was before, store to a watched
+//   location? Any store counts, even one that leaves the value the same.
+static bool hit_watchpoint(debugger_t *debugger, const chip8_t *chip8, const config_t config, const uint16_t PC, const uint16_t I) {
+    const writes_t writes = instruction_writes(chip8, config, PC, I);
+    for (uint32_t i = 0; i < debugger->num_watchpoints; i++) {
+        const watchpoint_t *watch = &debugger->watchpoints[i];
+        if (writes_watch(&writes, watch)) {
+            const uint16_t value = read_watch(chip8, watch);
+            printf("Watchpoint %u: ", i);
+            print_watch(watch);
+            printf(" 0x%X -> 0x%X by %04X at 0x%03X\n", watch->value, value, chip8->inst.opcode, PC);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Execute exactly 1 instruction with the reference interpreter, which ignores breakpoints
+//   patched into the decode cache, and finish the frame if this reached its end
+// Returns true if the instruction hit a watchpoint
+static bool step_instruction(debugger_t *debugger, chip8_t *chip8, const config_t config) {
+    const uint16_t PC = chip8->PC;
+    const uint16_t I = chip8->I;
+    read_watchpoints(debugger, chip8);
+
+    emulate_instruction(chip8, config);
+    const bool hit = debugger->num_watchpoints > 0 && hit_watchpoint(debugger, chip8, config, PC, I);
+
+    if (chip8->cycles >= next_frame_cycle(chip8, config))
+        end_frame(chip8, config);
+    return hit;
+}
+
+// Emulate a frame, checking watchpoints around every instruction. Only used while watchpoints
+//   are set, the regular emulate_frame() path has no checks at all.
+static stop_t emulate_watched_frame(debugger_t *debugger, chip8_t *chip8, const config_t config) {
+    const uint64_t frame_end = next_frame_cycle(chip8, config);
+
+    while (chip8->cycles < frame_end) {
+        read_watchpoints(debugger, chip8);
+
+        const uint16_t PC = chip8->PC;
+        const uint16_t I = chip8->I;
+        if (!emulate_cached_instruction(chip8, config)) return STOP_BREAKPOINT;
+        if (hit_watchpoint(debugger, chip8, config, PC, I)) return STOP_WATCHPOINT;
+    }
+
+    end_frame(chip8, config);
+    return STOP_NONE;
+}
+
+// Emulate a frame, stopping at breakpoints & watchpoints
+// Returns false if the debugger stopped, debugger->stopped is then set
+bool debug_emulate_frame(debugger_t *debugger, chip8_t *chip8, const config_t config) {
+    while (true) {
+        const stop_t stop = debugger->num_watchpoints == 0 ?
+                            (emulate_frame(chip8, config) ? STOP_NONE : STOP_BREAKPOINT) :
+                            emulate_watched_frame(debugger, chip8, config);
+
+        if (stop == STOP_NONE) return true;
+
+        if (stop == STOP_BREAKPOINT) {
+            const uint16_t PC = chip8->PC & 0x0FFF;
+
+            if (PC == debugger->step_over_address) {
+                // Recursive call hit the step over address, keep going until the original call returns
+                if (stack_depth(chip8) > debugger->step_over_depth) {
+                    if (!step_instruction(debugger, chip8, config)) continue;
+                    print_location(chip8);  // Watchpoint in the recursive call, step over stays pending
+                    debugger->stopped = true;
+                    debugger->at_breakpoint = false;
+                    return false;
+                }
+
+                debugger->step_over_address = -1;
+                clear_breakpoint(debugger, chip8, PC);
+            } else {
+                printf("Breakpoint at 0x%03X\n", PC);
+            }
+        }
+
+        print_location(chip8);
+        debugger->stopped = true;
+        debugger->at_breakpoint = stop == STOP_BREAKPOINT;
+        return false;
+    }
+}
+
+static void print_help(void) {
+    puts("Commands (addresses in hex):\n"
+         "  b ADDR       set breakpoint          d ADDR     delete breakpoint\n"
+         "  w ADDR|I|VX  set watchpoint on writes dw N      delete watchpoint N\n"
+         "  l            list break/watchpoints\n"
+         "  p            pause                   c          continue\n"
+         "  s            step                    n          step over 2NNN calls\n"
+         "  r            registers               k          stack\n"
+         "  m ADDR [LEN] memory dump");
+}
+
+// Run a console command on the emulation thread
+// Returns true if machine state changed and the display should be updated
+static bool run_command(debugger_t *debugger, chip8_t *chip8, const config_t config, char *line) {
+    const char *cmd = strtok(line, " \t\r\n");
+    const char *arg = strtok(NULL, " \t\r\n");
+    const char *arg2 = strtok(NULL, " \t\r\n");
+
+    if (!cmd) return false;
+
+    if (strcmp(cmd, "b") == 0 && arg) {
+        const uint16_t address = strtoul(arg, NULL, 16) & 0x0FFF;
+        if (is_breakpoint(debugger, address)) return false;
+        if (debugger->num_breakpoints == MAX_BREAKPOINTS) {
+            puts("Too many breakpoints");
+            return false;
+        }
+        debugger->breakpoints[debugger->num_breakpoints++] = address;
+        chip8->decoded[address].kind = DECODE_BREAK;
+        printf("Breakpoint set at 0x%03X\n", address);
+
+    } else if (strcmp(cmd, "d") == 0 && arg) {
+        const uint16_t address = strtoul(arg, NULL, 16) & 0x0FFF;
+        for (uint32_t i = 0; i < debugger->num_breakpoints; i++)
+            if (debugger->breakpoints[i] == address) {
+                debugger->breakpoints[i] = debugger->breakpoints[--debugger->num_breakpoints];
+                clear_breakpoint(debugger, chip8, address);
+                break;
+            }
+
+    } else if (strcmp(cmd, "w") == 0 && arg) {
+        if (debugger->num_watchpoints == MAX_WATCHPOINTS) {
+            puts("Too many watchpoints");
+            return false;
+        }
+        watchpoint_t watch = { .type = WATCH_RAM };
+        if (strcmp(arg, "I") == 0 || strcmp(arg, "i") == 0) {
+            watch.type = WATCH_I;
+        } else if (arg[0] == 'V' || arg[0] == 'v') {
+            watch.type = WATCH_V;
+            watch.address = strtoul(&arg[1], NULL, 16) & 0x0F;
+        } else {
+            watch.address = strtoul(arg, NULL, 16) & 0x0FFF;
+        }
+        debugger->watchpoints[debugger->num_watchpoints++] = watch;
+
+    } else if (strcmp(cmd, "dw") == 0 && arg) {
+        const uint32_t i = strtoul(arg, NULL, 10);
+        if (i < debugger->num_watchpoints) {
+            memmove(&debugger->watchpoints[i], &debugger->watchpoints[i + 1],
+                    (--debugger->num_watchpoints - i) * sizeof debugger->watchpoints[0]);
+        }
+
+    } else if (strcmp(cmd, "l") == 0) {
+        for (uint32_t i = 0; i < debugger->num_breakpoints; i++)
+            printf("Breakpoint 0x%03X\n", debugger->breakpoints[i]);
+        for (uint32_t i = 0; i < debugger->num_watchpoints; i++) {
+            printf("Watchpoint %u: ", i);
+            print_watch(&debugger->watchpoints[i]);
+            printf("\n");
+        }
+
+    } else if (strcmp(cmd, "p") == 0) {
+        debugger->stopped = true;
+        debugger->at_breakpoint = false;
+        print_location(chip8);
+
+    } else if (strcmp(cmd, "c") == 0) {
+        // Only a breakpoint stop is before its instruction, which has to be stepped past; after a
+        //   watchpoint or pause the frame resumes with all checks, incl. a breakpoint at PC
+        if (debugger->stopped && debugger->at_breakpoint) {
+            debugger->at_breakpoint = false;
+            if (step_instruction(debugger, chip8, config)) {
+                print_location(chip8);
+                return true;
+            }
+        }
+        debugger->stopped = false;
+
+    } else if (strcmp(cmd, "s") == 0 || strcmp(cmd, "n") == 0) {
+        const uint16_t PC = chip8->PC & 0x0FFF;
+        const bool call = (chip8->ram[PC] >> 4) == 0x2;
+
+        if (!debugger->stopped) {
+            debugger->stopped = true;   // Stop first, then step
+        } else if (strcmp(cmd, "n") == 0 && call) {
+            // Step over: run until the call returns to the next instruction
+            debugger->step_over_address = (PC + 2) & 0x0FFF;
+            debugger->step_over_depth = stack_depth(chip8);
+            chip8->decoded[debugger->step_over_address].kind = DECODE_BREAK;
+            step_instruction(debugger, chip8, config);
+            debugger->stopped = false;
+            return true;
+        } else {
+            step_instruction(debugger, chip8, config);
+        }
+        // Stepping onto a breakpoint stops at it, like running into it would
+        debugger->at_breakpoint = chip8->decoded[chip8->PC & 0x0FFF].kind == DECODE_BREAK;
+        print_location(chip8);
+        return true;
+
+    } else if (strcmp(cmd, "r") == 0) {
+        print_registers(chip8);
+
+    } else if (strcmp(cmd, "k") == 0) {
+        print_stack(chip8);
+
+    } else if (strcmp(cmd, "m") == 0 && arg) {
+        print_memory(chip8, strtoul(arg, NULL, 16) & 0x0FFF, arg2 ? strtoul(arg2, NULL, 16) : 16);
+
+    } else {
+        print_help();
+    }
+
+    return false;
+}
+
+// Run a pending console command, if any; called by the emulation thread between frames
+// Returns true if machine state changed and the display should be updated
+bool debug_commands(debugger_t *debugger, chip8_t *chip8, const config_t config) {
+    if (!SDL_AtomicGet(&debugger->pending)) return false;
+
+    SDL_LockMutex(debugger->lock);
+    const bool changed = run_command(debugger, chip8, config, debugger->command);
+    SDL_AtomicSet(&debugger->pending, 0);
+    SDL_CondSignal(debugger->cond);
+    SDL_UnlockMutex(debugger->lock);
+
+    return changed;
+}
+
+// Console thread, reads commands from stdin and waits for the emulation thread to run each one
+static int console_thread(void *data) {
+    debugger_t *debugger = data;
+    char line[sizeof debugger->command];
+
+    puts("CHIP8 debugger, 'h' for help");
+    while (true) {
+        printf("(chip8) ");
+        fflush(stdout);
+        if (!fgets(line, sizeof line, stdin)) break;
+
+        SDL_LockMutex(debugger->lock);
+        memcpy(debugger->command, line, sizeof line);
+        SDL_AtomicSet(&debugger->pending, 1);
+        while (SDL_AtomicGet(&debugger->pending))
+            SDL_CondWait(debugger->cond, debugger->lock);
+        SDL_UnlockMutex(debugger->lock);
+    }
+
+    return 0;
+}
+
+bool start_debugger(debugger_t *debugger) {
+    memset(debugger, 0, sizeof *debugger);
+    debugger->step_over_address = -1;
+
+    debugger->lock = SDL_CreateMutex();
+    debugger->cond = SDL_CreateCond();
+    if (!debugger->lock || !debugger->cond) {
+        SDL_Log("Could not create debugger console lock %s\n", SDL_GetError());
+        return false;
+    }
+
+    debugger->console = SDL_CreateThread(console_thread, "CHIP8 Debugger Console", debugger);
+    if (!debugger->console) {
+        SDL_Log("Could not create debugger console thread %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// The console thread is usually blocked reading stdin, so it is detached rather than waited for;
+//   its lock & condition variable are left for it, the process is exiting anyway
+void stop_debugger(debugger_t *debugger) {
+    SDL_DetachThread(debugger->console);
+    debugger->console = NULL;
+}
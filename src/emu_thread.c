@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+void init_triple_buffer(triple_buffer_t *tb) {
+    memset(tb, 0, sizeof *tb);
+    tb->write = 0;
+    SDL_AtomicSet(&tb->middle, 1);
+    tb->read = 2;
+}
+
+// Frame the producer may write into, it is not visible to the consumer until published
+frame_t *triple_buffer_write_frame(triple_buffer_t *tb) {
+    return &tb->frames[tb->write];
+}
+
+// Publish the producer's frame, and take back the middle frame to write the next one into.
+//   SDL_AtomicSet is a full barrier, so the frame contents are visible before the swap.
+// Returns true if the frame taken back was published but never read, the consumer skipped it
+bool triple_buffer_publish(triple_buffer_t *tb) {
+    const int middle = SDL_AtomicSet(&tb->middle, tb->write | FRAME_READY);
+    tb->write = middle & FRAME_INDEX_MASK;
+    return middle & FRAME_READY;
+}
+
+// Get the newest published frame, or NULL if nothing new was published since the last call.
+//   Frames published in between are skipped, the consumer always sees the latest one.
+const frame_t *triple_buffer_read_frame(triple_buffer_t *tb) {
+    if (!(SDL_AtomicGet(&tb->middle) & FRAME_READY)) return NULL;
+
+    tb->read = SDL_AtomicSet(&tb->middle, tb->read) & FRAME_INDEX_MASK;
+    return &tb->frames[tb->read];
+}
+
+// Connect the machine to the emulator's outputs and debugger, after start or reset
+static void attach_machine(emulator_t *emu) {
+    emu->chip8.audio = &emu->audio;
+    emu->chip8.trace = emu->config.trace_file ? &emu->trace : NULL;
+    emu->chip8.latency = emu->config.latency_file ? &emu->latency : NULL;
+    emu->chip8.profile = emu->config.profile ? &emu->profile : NULL;
+    if (emu->config.debugger) apply_breakpoints(&emu->debugger, &emu->chip8);
+}
+
+// Hand the frame being written to the render thread
+static void publish_frame(emulator_t *emu) {
+    if (emu->chip8.latency)
+        latency_publish(emu->chip8.latency, triple_buffer_write_frame(&emu->frames));
+
+    // A skipped frame was never presented, its probes complete with the next one instead
+    if (triple_buffer_publish(&emu->frames) && emu->chip8.latency)
+        latency_requeue(emu->chip8.latency, triple_buffer_write_frame(&emu->frames));
+    emu->chip8.draw = false;
+}
+
+// Hand the real machine's current display to the render thread
+static void publish_display(emulator_t *emu) {
+    memcpy(triple_buffer_write_frame(&emu->frames)->display, emu->chip8.display, sizeof emu->chip8.display);
+    publish_frame(emu);
+}
+
+// Emulation thread: runs 60hz frames paced against absolute deadlines, so a slow present,
+//   vsync stall or blocked event loop on the render thread can not delay the CPU or timers
+static int emulator_thread(void *data) {
+    emulator_t *emu = data;
+    chip8_t *chip8 = &emu->chip8;
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t frame_ticks = freq / 60;
+    uint64_t next_frame_time = SDL_GetPerformanceCounter();
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (SDL_AtomicGet(&emu->state) != QUIT) {
+        if (SDL_AtomicSet(&emu->reset, 0)) {
+            // Reset CHIP8 machine for the current ROM
+            init_chip8(chip8, emu->config, chip8->rom_name);
+            attach_machine(emu);
+            SDL_AtomicCAS(&emu->state, PAUSED, RUNNING);    // Resume if paused, a pending quit stays
+        }
+
+        // Debugger commands run between frames, also while paused
+        if (emu->config.debugger && debug_commands(&emu->debugger, chip8, emu->config) && chip8->draw)
+            publish_display(emu);
+
+        // Paused or stopped in the debugger, only commands run
+        if (SDL_AtomicGet(&emu->state) == PAUSED || (emu->config.debugger && emu->debugger.stopped)) {
+            stop_audio(&emu->audio);    // No samples are rendered, audio callback plays silence
+            SDL_Delay(1);
+            next_frame_time = SDL_GetPerformanceCounter();
+            continue;
+        }
+
+        // Latch input for this frame
+        const int keys = SDL_AtomicGet(&emu->keypad);
+        for (uint8_t i = 0; i < sizeof chip8->keypad; i++)
+            chip8->keypad[i] = (keys >> i) & 1;
+        if (chip8->latency) latency_latch(chip8->latency);
+
+        start_audio(&emu->audio);   // Pre-fills the ring when starting or resuming
+
+        // Emulate CHIP8 Instructions for this emulator "frame" (60hz), incl. delay & sound timers
+        if (emu->config.debugger) {
+            if (!debug_emulate_frame(&emu->debugger, chip8, emu->config)) {
+                publish_display(emu);   // Show the display as of where we stopped
+                continue;
+            }
+        } else {
+            emulate_frame(chip8, emu->config);
+        }
+
+        // Hand the displayed frame (run-ahead or real) to the render thread
+        frame_t *frame = triple_buffer_write_frame(&emu->frames);
+        bool draw = chip8->draw;
+        if (emu->config.run_ahead_frames > 0)
+            draw = run_ahead(chip8, emu->config, frame->display, &emu->ahead);
+        else if (draw)
+            memcpy(frame->display, chip8->display, sizeof frame->display);
+
+        if (draw) publish_frame(emu);
+
+        // Wait for the next 60hz deadline; sleep most of the way, then spin for precision
+        next_frame_time += frame_ticks;
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (now > next_frame_time + 4 * frame_ticks) {
+            next_frame_time = now;  // Fell far behind (e.g. suspended), don't try to catch up
+            continue;
+        }
+        while (now < next_frame_time) {
+            const uint64_t ms_left = (next_frame_time - now) * 1000 / freq;
+            if (ms_left > 2) SDL_Delay(ms_left - 1);
+            now = SDL_GetPerformanceCounter();
+        }
+    }
+
+    stop_audio(&emu->audio);
+    return 0;
+}
+
+bool start_emulator_thread(emulator_t *emu) {
+    init_triple_buffer(&emu->frames);
+    attach_machine(emu);
+    SDL_AtomicSet(&emu->state, RUNNING);
+    SDL_AtomicSet(&emu->keypad, 0);
+    SDL_AtomicSet(&emu->reset, 0);
+    SDL_AtomicSet(&emu->audio.producing, 0);
+
+    emu->thread = SDL_CreateThread(emulator_thread, "CHIP8 Emulation", emu);
+    if (!emu->thread) {
+        SDL_Log("Could not create emulation thread %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// Signal the emulation thread to quit and wait for it
+void stop_emulator_thread(emulator_t *emu) {
+    SDL_AtomicSet(&emu->state, QUIT);
+    SDL_WaitThread(emu->thread, NULL);
+    emu->thread = NULL;
+}
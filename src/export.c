@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+// Headless export: emulate a ROM as fast as possible without a window, replaying an input log,
+//   and stream every frame (Y4M or raw RGBA), PNG snapshots and WAV audio to files or a pipe.
+
+// Helpers to write little/big endian values
+static void write_le16(uint8_t out[], const uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void write_le32(uint8_t out[], const uint32_t value) {
+    write_le16(&out[0], value & 0xFFFF);
+    write_le16(&out[2], value >> 16);
+}
+
+static void write_be32(uint8_t out[], const uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+// Is output pixel x,y of the scaled frame lit
+static inline bool pixel_on(const bool display[], const config_t config, const uint32_t x, const uint32_t y) {
+    return display[(y / config.scale_factor) * config.window_width + x / config.scale_factor];
+}
+
+// 44 byte canonical WAV header for 16 bit mono PCM; sizes are patched once the length is known
+static void write_wav_header(FILE *file, const uint32_t sample_rate, const uint32_t num_samples) {
+    uint8_t header[44];
+    const uint32_t data_size = num_samples * sizeof(int16_t);
+
+    memcpy(&header[0], "RIFF", 4);
+    write_le32(&header[4], 36 + data_size);
+    memcpy(&header[8], "WAVEfmt ", 8);
+    write_le32(&header[16], 16);                // fmt chunk size
+    write_le16(&header[20], 1);                 // PCM
+    write_le16(&header[22], 1);                 // Mono
+    write_le32(&header[24], sample_rate);
+    write_le32(&header[28], sample_rate * sizeof(int16_t));     // Byte rate
+    write_le16(&header[32], sizeof(int16_t));   // Block align
+    write_le16(&header[34], 16);                // Bits per sample
+    memcpy(&header[36], "data", 4);
+    write_le32(&header[40], data_size);
+
+    fwrite(header, sizeof header, 1, file);
+}
+
+// Y4M 4:2:0 frame: full resolution luma, then Cb and Cr averaged over 2x2 blocks.
+//   The scaled frame is always an even size, as the display is.
+static bool write_y4m_frame(exporter_t *export, const config_t config, const bool display[]) {
+    const uint32_t width = config.window_width * config.scale_factor;
+    const uint32_t height = config.window_height * config.scale_factor;
+    const uint32_t colors[2] = { config.bg_color, config.fg_color };
+    int32_t Y[2], Cb[2], Cr[2];
+
+    // Full range BT.601 (JFIF) conversion of the 2 colors
+    for (int i = 0; i < 2; i++) {
+        const int32_t r = (colors[i] >> 24) & 0xFF;
+        const int32_t g = (colors[i] >> 16) & 0xFF;
+        const int32_t b = (colors[i] >>  8) & 0xFF;
+        Y[i]  = (  19595 * r + 38470 * g +  7471 * b + 32768) >> 16;
+        Cb[i] = (( -11059 * r - 21709 * g + 32768 * b + 32768) >> 16) + 128;
+        Cr[i] = ((  32768 * r - 27439 * g -  5329 * b + 32768) >> 16) + 128;
+    }
+
+    uint8_t *luma = export->image;
+    uint8_t *cb = luma + width * height;
+    uint8_t *cr = cb + (width / 2) * (height / 2);
+
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t x = 0; x < width; x++)
+            luma[y * width + x] = Y[pixel_on(display, config, x, y)];
+
+    for (uint32_t y = 0; y < height / 2; y++) {
+        for (uint32_t x = 0; x < width / 2; x++) {
+            const int on = pixel_on(display, config, 2*x, 2*y)     + pixel_on(display, config, 2*x + 1, 2*y) +
+                           pixel_on(display, config, 2*x, 2*y + 1) + pixel_on(display, config, 2*x + 1, 2*y + 1);
+            cb[y * (width / 2) + x] = (on * Cb[1] + (4 - on) * Cb[0] + 2) / 4;
+            cr[y * (width / 2) + x] = (on * Cr[1] + (4 - on) * Cr[0] + 2) / 4;
+        }
+    }
+
+    return fputs("FRAME\n", export->video) != EOF &&
+           fwrite(export->image, width * height + 2 * (width / 2) * (height / 2), 1, export->video) == 1;
+}
+
+// Raw RGBA frame, 4 bytes per pixel in R, G, B, A order
+static bool write_rgba_frame(exporter_t *export, const config_t config, const bool display[]) {
+    const uint32_t width = config.window_width * config.scale_factor;
+    const uint32_t height = config.window_height * config.scale_factor;
+
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t x = 0; x < width; x++)
+            write_be32(&export->image[(y * width + x) * 4],
+                       pixel_on(display, config, x, y) ? config.fg_color : config.bg_color);
+
+    return fwrite(export->image, width * height * 4, 1, export->video) == 1;
+}
+
+// CRC-32 as used by PNG chunks
+static uint32_t crc32_update(uint32_t crc, const uint8_t data[], const size_t length) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Write a PNG chunk: length, type, data, CRC of type & data
+static void write_png_chunk(FILE *file, const char type[4], const uint8_t data[], const uint32_t length) {
+    uint8_t word[4];
+
+    write_be32(word, length);
+    fwrite(word, 4, 1, file);
+    fwrite(type, 4, 1, file);
+    if (length) fwrite(data, length, 1, file);
+
+    write_be32(word, crc32_update(crc32_update(0, (const uint8_t *)type, 4), data, length));
+    fwrite(word, 4, 1, file);
+}
+
+// Write the frame as a 1 bit per pixel palette PNG (bg, fg). The image data goes in uncompressed
+//   ("stored") deflate blocks, which keeps the encoder self-contained; at 1 bit per pixel they are
+//   still small.
+static bool write_png(const config_t config, const bool display[], const char path[]) {
+    const uint32_t width = config.window_width * config.scale_factor;
+    const uint32_t height = config.window_height * config.scale_factor;
+    const uint32_t row_bytes = 1 + (width + 7) / 8;     // Filter type byte, then packed pixels
+    const uint32_t raw_size = row_bytes * height;
+    const uint32_t num_blocks = (raw_size + 0xFFFE) / 0xFFFF;
+    const uint32_t idat_size = 2 + raw_size + 5 * num_blocks + 4;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        SDL_Log("Could not open PNG file %s\n", path);
+        return false;
+    }
+
+    uint8_t *raw = calloc(1, raw_size);
+    uint8_t *idat = malloc(idat_size);
+    if (!raw || !idat) {
+        SDL_Log("Could not allocate PNG buffers for %s\n", path);
+        free(raw);
+        free(idat);
+        fclose(file);
+        return false;
+    }
+
+    // Scanlines, filter type 0 (none)
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t x = 0; x < width; x++)
+            if (pixel_on(display, config, x, y))
+                raw[y * row_bytes + 1 + x / 8] |= 0x80 >> (x % 8);
+
+    // zlib stream: header, stored deflate blocks of up to 65535 bytes, adler32 of the raw data
+    uint32_t pos = 0;
+    uint32_t s1 = 1, s2 = 0;
+    idat[pos++] = 0x78;
+    idat[pos++] = 0x01;
+    for (uint32_t offset = 0; offset < raw_size; offset += 0xFFFF) {
+        const uint32_t length = raw_size - offset < 0xFFFF ? raw_size - offset : 0xFFFF;
+        idat[pos++] = offset + length == raw_size;  // BFINAL on the last block, BTYPE 00 stored
+        write_le16(&idat[pos], length);
+        write_le16(&idat[pos + 2], ~length & 0xFFFF);
+        pos += 4;
+        memcpy(&idat[pos], &raw[offset], length);
+        pos += length;
+    }
+    for (uint32_t i = 0; i < raw_size; i++) {
+        s1 = (s1 + raw[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    write_be32(&idat[pos], (s2 << 16) | s1);
+
+    uint8_t ihdr[13];
+    write_be32(&ihdr[0], width);
+    write_be32(&ihdr[4], height);
+    ihdr[8] = 1;    // Bit depth
+    ihdr[9] = 3;    // Color type: palette
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;     // Deflate, adaptive filtering, no interlace
+
+    const uint8_t palette[6] = {
+        (config.bg_color >> 24) & 0xFF, (config.bg_color >> 16) & 0xFF, (config.bg_color >> 8) & 0xFF,
+        (config.fg_color >> 24) & 0xFF, (config.fg_color >> 16) & 0xFF, (config.fg_color >> 8) & 0xFF,
+    };
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, sizeof signature, 1, file);
+    write_png_chunk(file, "IHDR", ihdr, sizeof ihdr);
+    write_png_chunk(file, "PLTE", palette, sizeof palette);
+    write_png_chunk(file, "IDAT", idat, idat_size);
+    write_png_chunk(file, "IEND", NULL, 0);
+
+    free(raw);
+    free(idat);
+
+    // Chunk writes are checked once, through the stream error flag
+    const bool written = !ferror(file);
+    if (fclose(file) != 0 || !written) {
+        SDL_Log("Could not write PNG file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Encoder thread: converts & writes queued frames, PNG snapshots and audio
+static int export_encoder_thread(void *data) {
+    emulator_t *emu = data;
+    exporter_t *export = &emu->export;
+    const config_t config = emu->config;
+
+    SDL_LockMutex(export->lock);
+    while (true) {
+        while (export->tail == export->head && !export->quit)
+            SDL_CondWait(export->cond, export->lock);
+
+        if (export->tail == export->head) break;    // Quit, and everything is written
+        const export_frame_t *frame = &export->queue[export->tail % EXPORT_QUEUE_SIZE];
+        const bool failed = export->failed;
+        SDL_UnlockMutex(export->lock);
+
+        // Encode & write without holding the lock; after a failure frames are only dropped
+        bool written = true;
+        if (!failed) {
+            written = config.export_format == EXPORT_Y4M ?
+                      write_y4m_frame(export, config, frame->display) :
+                      write_rgba_frame(export, config, frame->display);
+            if (!written) SDL_Log("Could not write export file %s\n", config.export_file);
+
+            if (written && config.png_every && frame->frame % config.png_every == 0) {
+                char path[1024];
+                snprintf(path, sizeof path, "%s%06llu.png", config.png_prefix, (long long unsigned)frame->frame);
+                written = write_png(config, frame->display, path);
+            }
+
+            if (written && export->wav) {
+                written = fwrite(frame->samples, sizeof frame->samples[0], frame->num_samples, export->wav) ==
+                          frame->num_samples;
+                if (!written) SDL_Log("Could not write WAV file %s\n", config.wav_file);
+                export->samples += frame->num_samples;
+            }
+        }
+
+        SDL_LockMutex(export->lock);
+        if (!written) export->failed = true;
+        export->tail++;
+        SDL_CondBroadcast(export->cond);
+    }
+    SDL_UnlockMutex(export->lock);
+
+    return 0;
+}
+
+// Load a keypad input log: one "<frame> <key 0-F> <1 pressed|0 released>" per line, frames in
+//   increasing order; blank lines and lines starting with # are ignored
+static bool load_input_log(exporter_t *export, const char path[]) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        SDL_Log("Could not open input log %s\n", path);
+        return false;
+    }
+
+    char line[128];
+    uint32_t line_number = 0;
+    uint32_t capacity = 0;
+    while (fgets(line, sizeof line, file)) {
+        line_number++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+
+        long long unsigned frame;
+        unsigned key, pressed;
+        if (sscanf(line, "%llu %x %u", &frame, &key, &pressed) != 3 || key > 0xF || pressed > 1 ||
+            (export->num_events && frame < export->events[export->num_events - 1].frame)) {
+            SDL_Log("Invalid input log entry at %s:%u\n", path, line_number);
+            fclose(file);
+            return false;
+        }
+
+        if (export->num_events == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            input_event_t *events = realloc(export->events, capacity * sizeof *events);
+            if (!events) {
+                fclose(file);
+                return false;
+            }
+            export->events = events;
+        }
+
+        export->events[export->num_events++] = (input_event_t){
+            .frame = frame,
+            .key = key,
+            .pressed = pressed,
+        };
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool start_export(emulator_t *emu) {
+    exporter_t *export = &emu->export;
+    const config_t config = emu->config;
+    const uint32_t width = config.window_width * config.scale_factor;
+    const uint32_t height = config.window_height * config.scale_factor;
+
+    if (config.input_file && !load_input_log(export, config.input_file)) return false;
+
+    export->video = strcmp(config.export_file, "-") == 0 ? stdout : fopen(config.export_file, "wb");
+    if (!export->video) {
+        SDL_Log("Could not open export file %s\n", config.export_file);
+        return false;
+    }
+    // C420jpeg is 4:2:0 with JPEG chroma siting; the samples are full range, which decoders
+    //   only assume when told so with XCOLORRANGE
+    if (config.export_format == EXPORT_Y4M)
+        fprintf(export->video, "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height);
+
+    if (config.wav_file) {
+        export->wav = fopen(config.wav_file, "wb");
+        if (!export->wav) {
+            SDL_Log("Could not open WAV file %s\n", config.wav_file);
+            return false;
+        }
+        write_wav_header(export->wav, config.audio_sample_rate, 0);
+    }
+
+    export->image = malloc(width * height * 4);
+    export->lock = SDL_CreateMutex();
+    export->cond = SDL_CreateCond();
+    if (!export->image || !export->lock || !export->cond) {
+        SDL_Log("Could not allocate export buffers %s\n", SDL_GetError());
+        return false;
+    }
+
+    export->thread = SDL_CreateThread(export_encoder_thread, "CHIP8 Export Encoder", emu);
+    if (!export->thread) {
+        SDL_Log("Could not create export encoder thread %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// Wait for the encoder to write everything queued, then finish & close the files
+// Returns false if anything could not be written
+static bool stop_export(emulator_t *emu) {
+    exporter_t *export = &emu->export;
+
+    SDL_LockMutex(export->lock);
+    export->quit = true;
+    SDL_CondBroadcast(export->cond);
+    SDL_UnlockMutex(export->lock);
+
+    SDL_WaitThread(export->thread, NULL);
+    bool written = !export->failed;
+
+    if (export->wav) {
+        // Patch in the final sizes, if the file is seekable
+        if (fseek(export->wav, 0, SEEK_SET) == 0)
+            write_wav_header(export->wav, emu->config.audio_sample_rate, (uint32_t)export->samples);
+        const bool wav_error = ferror(export->wav);
+        if (fclose(export->wav) != 0 || wav_error) {
+            SDL_Log("Could not write WAV file %s\n", emu->config.wav_file);
+            written = false;
+        }
+    }
+    if ((export->video == stdout ? fflush(stdout) : fclose(export->video)) != 0) {
+        SDL_Log("Could not write export file %s\n", emu->config.export_file);
+        written = false;
+    }
+
+    free(export->image);
+    free(export->events);
+    SDL_DestroyCond(export->cond);
+    SDL_DestroyMutex(export->lock);
+
+    return written;
+}
+
+// Get the next free frame in the queue, waiting for the encoder if the queue is full
+// Returns NULL if the encoder failed to write, there is no point emulating further
+static export_frame_t *export_write_frame(exporter_t *export) {
+    SDL_LockMutex(export->lock);
+    while (export->head - export->tail == EXPORT_QUEUE_SIZE)
+        SDL_CondWait(export->cond, export->lock);
+    export_frame_t *frame = export->failed ? NULL : &export->queue[export->head % EXPORT_QUEUE_SIZE];
+    SDL_UnlockMutex(export->lock);
+
+    return frame;
+}
+
+// Hand the frame from export_write_frame() to the encoder
+static void export_publish(exporter_t *export) {
+    SDL_LockMutex(export->lock);
+    export->head++;
+    SDL_CondBroadcast(export->cond);
+    SDL_UnlockMutex(export->lock);
+}
+
+// Take all samples rendered so far out of the audio ring, the exporter is its only consumer
+static uint32_t drain_audio(audio_t *audio, int16_t samples[], const uint32_t max_samples) {
+    const uint32_t tail = SDL_AtomicGet(&audio->tail);
+    uint32_t count = (uint32_t)SDL_AtomicGet(&audio->head) - tail;
+    if (count > max_samples) count = max_samples;
+
+    for (uint32_t i = 0; i < count; i++)
+        samples[i] = audio->samples[(tail + i) & (AUDIO_RING_SIZE - 1)];
+
+    SDL_AtomicSet(&audio->tail, tail + count);
+    return count;
+}
+
+// Run the ROM headless for config.export_frames frames, as fast as the core and encoder allow
+bool run_export(emulator_t *emu, const char rom_name[]) {
+    const config_t config = emu->config;
+    chip8_t *chip8 = &emu->chip8;
+
+    if (!init_chip8(chip8, config, rom_name)) return false;
+    if (config.trace_file && !start_trace(&emu->trace, config.trace_file)) return false;
+    if (!start_export(emu)) return false;
+
+    // Audio is rendered at exactly the export rate; without a device draining the ring in real
+    //   time there is nothing for rate control to steer (target_fill 0)
+    emu->audio.sample_rate = config.audio_sample_rate;
+    emu->audio.target_fill = 0;
+    emu->audio.square_wave_freq = config.square_wave_freq;
+    SDL_AtomicSet(&emu->audio.volume, config.volume);
+
+    chip8->audio = &emu->audio;
+    chip8->trace = config.trace_file ? &emu->trace : NULL;
+    chip8->profile = config.profile ? &emu->profile : NULL;
+
+    const uint64_t start_time = SDL_GetPerformanceCounter();
+    uint32_t next_event = 0;
+    uint32_t frame_number;
+
+    for (frame_number = 0; frame_number < config.export_frames; frame_number++) {
+        // Replay input for this frame
+        for (; next_event < emu->export.num_events && emu->export.events[next_event].frame <= frame_number; next_event++)
+            chip8->keypad[emu->export.events[next_event].key] = emu->export.events[next_event].pressed;
+
+        emulate_frame(chip8, config);
+
+        export_frame_t *frame = export_write_frame(&emu->export);
+        if (!frame) break;
+        frame->frame = frame_number;
+        memcpy(frame->display, chip8->display, sizeof frame->display);
+        frame->num_samples = drain_audio(&emu->audio, frame->samples, EXPORT_MAX_SAMPLES);
+        export_publish(&emu->export);
+    }
+
+    const bool written = stop_export(emu);
+    if (config.trace_file) stop_trace(&emu->trace);
+    if (config.profile) report_profile(&emu->profile);
+
+    const double seconds = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+    SDL_Log("Export: %u frames in %.2fs (%.1fx realtime), %llu audio samples\n",
+            frame_number, seconds, seconds > 0 ? frame_number / 60.0 / seconds : 0.0,
+            (long long unsigned)emu->export.samples);
+
+    return written;
+}
@@ -0,0 +1,758 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+
+// chip8_fuzz: Differential fuzzer for the execution engines. Generates random & mutated ROMs and
+//   keypad input, runs the reference interpreter (emulate_instruction) and every faster engine in
+//   lockstep, and compares machine state hashes. Divergent cases are minimized & saved.
+//
+//   Engines compared against the reference:
+//     cached  emulate_cached_instruction(), hashed every --check-every instructions
+//     fused   emulate_fused_step() with superinstructions, hashed at every frame boundary
+
+#define FUZZ_MAX_ROM     (4096 - 0x200)
+#define FUZZ_MAX_EVENTS  256
+#define FUZZ_MAX_CORPUS  64
+#define FUZZ_MAX_REPORTS 16     // Divergent cases to minimize & save, the rest are only counted
+#define FUZZ_MAX_SUBS    6      // Subroutines in a generated ROM
+#define FUZZ_DATA_SIZE   0x100  // Bytes generated stores & loads mostly go to
+
+typedef enum {
+    ENGINE_CACHED,
+    ENGINE_FUSED,
+    NUM_ENGINES,
+} engine_t;
+
+static const char *engine_names[NUM_ENGINES] = { "cached", "fused" };
+
+// Where generated code may point: jumps stay in the main loop, calls go to subroutine entries,
+//   I to the image (self-modifying code, for cache invalidation), the font or a data area
+typedef struct {
+    uint16_t main_end;              // Main loop is 0x200..main_end-1
+    uint16_t subs[FUZZ_MAX_SUBS];   // Subroutine entry points, in increasing address order
+    uint32_t num_subs;
+    uint32_t sub;                   // Subroutine being generated, num_subs for the main loop
+    uint16_t image_end;
+    uint16_t data;                  // Data area, FUZZ_DATA_SIZE bytes
+} layout_t;
+
+// A ROM, its input log and configuration; replaying one always gives the same result
+typedef struct {
+    uint8_t rom[FUZZ_MAX_ROM];
+    uint32_t rom_size;
+    input_event_t events[FUZZ_MAX_EVENTS];
+    uint32_t num_events;
+    config_t config;
+    uint32_t frames;
+    layout_t layout;
+} fuzz_case_t;
+
+typedef enum {
+    RESULT_OK,
+    RESULT_UNSAFE,      // Stopped before an instruction with undefined behaviour, e.g. stack overflow
+    RESULT_DIVERGED,
+} result_t;
+
+typedef struct {
+    result_t result;
+    engine_t engine;        // Engine that diverged
+    uint64_t frame;         // Frame it diverged or stopped in, or the number of frames run
+    uint64_t instructions;  // Reference instructions run
+} outcome_t;
+
+// Machines for one case, one per engine plus the reference
+typedef struct {
+    chip8_t reference;
+    chip8_t engines[NUM_ENGINES];
+} machines_t;
+
+typedef struct {
+    config_t defaults;
+    uint32_t threads;
+    uint32_t seconds;
+    uint64_t max_cases;
+    uint32_t check_every;
+    uint32_t frames;
+    uint64_t seed;
+    const char *out_prefix;
+    uint8_t corpus[FUZZ_MAX_CORPUS][FUZZ_MAX_ROM];
+    uint32_t corpus_size[FUZZ_MAX_CORPUS];
+    uint32_t num_corpus;
+    uint64_t deadline;          // Performance counter value to stop at
+    SDL_atomic_t cases;
+    SDL_atomic_t unsafe;
+    SDL_atomic_t divergences;
+    SDL_atomic_t reports;
+    SDL_mutex *lock;            // Protects the totals below & output
+    uint64_t instructions;      // Reference instructions run
+    uint64_t frames_reached;    // Frames run before a case stopped or ended
+    uint64_t fusions;           // Superinstructions run by the fused engine
+    uint64_t skipped_waits;     // Timer wait loop iterations the fused engine skipped
+} fuzzer_t;
+
+typedef struct {
+    fuzzer_t *fuzzer;
+    uint32_t id;
+    uint64_t rng;
+    machines_t machines;
+    profile_t profile;          // Fused engine counters
+    fuzz_case_t current, previous, minimized;
+    bool have_previous;
+} worker_t;
+
+// xorshift64* per worker random numbers
+static uint32_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (uint32_t)((*state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static uint32_t random_below(uint64_t *state, const uint32_t n) {
+    return next_random(state) % n;
+}
+
+// Hash everything that makes up the machine state; pointers, the decode cache & output hooks
+//   are excluded, the stack pointer is hashed as a depth
+static inline uint64_t hash_bytes(uint64_t hash, const void *data, const size_t size) {
+    const uint8_t *bytes = data;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, &bytes[i], 8);
+        hash = (hash ^ word) * 0x100000001B3ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+
+    return hash;
+}
+
+static uint64_t hash_state(const chip8_t *chip8) {
+    const uint64_t depth = chip8->stack_ptr - chip8->stack;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    hash = hash_bytes(hash, chip8->ram, sizeof chip8->ram);
+    hash = hash_bytes(hash, chip8->display, sizeof chip8->display);
+    hash = hash_bytes(hash, chip8->stack, depth * sizeof chip8->stack[0]);
+    hash = hash_bytes(hash, &depth, sizeof depth);
+    hash = hash_bytes(hash, chip8->V, sizeof chip8->V);
+    hash = hash_bytes(hash, &chip8->I, sizeof chip8->I);
+    hash = hash_bytes(hash, &chip8->PC, sizeof chip8->PC);
+    hash = hash_bytes(hash, &chip8->delay_timer, sizeof chip8->delay_timer);
+    hash = hash_bytes(hash, &chip8->sound_timer, sizeof chip8->sound_timer);
+    hash = hash_bytes(hash, chip8->keypad, sizeof chip8->keypad);
+    hash = hash_bytes(hash, &chip8->inst, sizeof chip8->inst);
+    hash = hash_bytes(hash, &chip8->draw, sizeof chip8->draw);
+    hash = hash_bytes(hash, &chip8->key_wait_pressed, sizeof chip8->key_wait_pressed);
+    hash = hash_bytes(hash, &chip8->key_wait_key, sizeof chip8->key_wait_key);
+    hash = hash_bytes(hash, &chip8->rng, sizeof chip8->rng);
+    hash = hash_bytes(hash, &chip8->cycles, sizeof chip8->cycles);
+    hash = hash_bytes(hash, &chip8->frames, sizeof chip8->frames);
+    hash = hash_bytes(hash, chip8->audio_pattern, sizeof chip8->audio_pattern);
+    hash = hash_bytes(hash, &chip8->pitch, sizeof chip8->pitch);
+
+    return hash;
+}
+
+// Would the next instruction do something the core leaves undefined (reading/writing past ram,
+//   over/underflowing the stack, indexing the keypad past key F)? Those are not engine bugs
+//   and can crash the fuzzer, so the case stops before running one.
+static bool unsafe_instruction(const chip8_t *chip8) {
+    if (chip8->PC > sizeof chip8->ram - 2) return true;
+
+    const uint16_t opcode = (chip8->ram[chip8->PC] << 8) | chip8->ram[chip8->PC + 1];
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t NN = opcode & 0xFF;
+    const uint32_t depth = chip8->stack_ptr - chip8->stack;
+
+    switch (opcode >> 12) {
+        case 0x0: return NN == 0xEE && depth == 0;   // The core decodes 0x0XEE as a return too
+        case 0x2: return depth == sizeof chip8->stack / sizeof chip8->stack[0];
+        case 0xD: return (size_t)chip8->I + (opcode & 0x0F) > sizeof chip8->ram;
+        case 0xE: return (NN == 0x9E || NN == 0xA1) && chip8->V[X] > 0xF;
+        case 0xF:
+            if (NN == 0x33) return (size_t)chip8->I + 3 > sizeof chip8->ram;
+            if (NN == 0x55 || NN == 0x65) return (size_t)chip8->I + X + 1 > sizeof chip8->ram;
+            return false;
+        default: return false;
+    }
+}
+
+// Would a superinstruction starting at PC read past ram in its second instruction: an ANNN+DXYN
+//   sprite or FX33+FX65 load at the end of ram
+static bool unsafe_fusion(const chip8_t *chip8) {
+    if (chip8->PC > sizeof chip8->ram - 4) return false;    // Too close to the end to be fused
+
+    const uint16_t opcode = (chip8->ram[chip8->PC] << 8) | chip8->ram[chip8->PC + 1];
+    const uint16_t next = (chip8->ram[chip8->PC + 2] << 8) | chip8->ram[chip8->PC + 3];
+
+    if ((opcode >> 12) == 0xA && (next >> 12) == 0xD)
+        return (size_t)(opcode & 0x0FFF) + (next & 0x0F) > sizeof chip8->ram;
+    if ((opcode & 0xF0FF) == 0xF033 && (next & 0xF0FF) == 0xF065)
+        return (size_t)chip8->I + ((next >> 8) & 0x0F) + 1 > sizeof chip8->ram;
+    return false;
+}
+
+// Apply input log events for a frame to all machines
+static void apply_input(const fuzz_case_t *c, uint32_t *next_event, const uint64_t frame, machines_t *m) {
+    for (; *next_event < c->num_events && c->events[*next_event].frame <= frame; (*next_event)++) {
+        const input_event_t *event = &c->events[*next_event];
+        m->reference.keypad[event->key] = event->pressed;
+        for (engine_t e = 0; e < NUM_ENGINES; e++)
+            m->engines[e].keypad[event->key] = event->pressed;
+    }
+}
+
+// Run a case on the reference and all engines in lockstep, counting fused engine work in profile (may be NULL)
+static outcome_t run_case(const fuzz_case_t *c, const uint32_t check_every, machines_t *m, profile_t *profile) {
+    outcome_t outcome = { .result = RESULT_OK };
+    chip8_t *ref = &m->reference;
+    chip8_t *cached = &m->engines[ENGINE_CACHED];
+    chip8_t *fused = &m->engines[ENGINE_FUSED];
+    uint32_t next_event = 0;
+    uint32_t until_check = check_every;
+
+    init_chip8_from_memory(ref, c->config, c->rom, c->rom_size);
+    for (engine_t e = 0; e < NUM_ENGINES; e++)
+        init_chip8_from_memory(&m->engines[e], c->config, c->rom, c->rom_size);
+    fused->profile = profile;
+
+    for (uint64_t frame = 0; frame < c->frames; frame++) {
+        outcome.frame = frame;
+        apply_input(c, &next_event, frame, m);
+
+        // Reference & cached engine, instruction by instruction
+        const uint64_t frame_end = next_frame_cycle(ref, c->config);
+        while (ref->cycles < frame_end) {
+            if (unsafe_instruction(ref)) {
+                outcome.result = RESULT_UNSAFE;
+                return outcome;
+            }
+
+            if (unsafe_instruction(cached)) {
+                outcome.result = RESULT_DIVERGED;   // Only the cached engine went astray
+                outcome.engine = ENGINE_CACHED;
+                return outcome;
+            }
+
+            emulate_instruction(ref, c->config);
+            emulate_cached_instruction(cached, c->config);
+            outcome.instructions++;
+
+            if (--until_check == 0) {
+                until_check = check_every;
+                if (hash_state(ref) != hash_state(cached)) {
+                    outcome.result = RESULT_DIVERGED;
+                    outcome.engine = ENGINE_CACHED;
+                    return outcome;
+                }
+            }
+        }
+        end_frame(ref, c->config);
+        end_frame(cached, c->config);
+
+        // Fused engine, a superinstruction at a time. The reference ran this frame without an
+        //   unsafe instruction, so the fused engine reaching one means it went astray.
+        const uint64_t fused_end = next_frame_cycle(fused, c->config);
+        while (fused->cycles < fused_end) {
+            if (unsafe_instruction(fused)) {
+                outcome.result = RESULT_DIVERGED;
+                outcome.engine = ENGINE_FUSED;
+                return outcome;
+            }
+
+            // The second instruction of a superinstruction is not checked by the above, run one
+            //   that would go past ram unfused; the next step checks it, or the reference next frame
+            if (unsafe_fusion(fused)) emulate_cached_instruction(fused, c->config);
+            else emulate_fused_step(fused, c->config, fused_end);
+        }
+        end_frame(fused, c->config);
+
+        const uint64_t ref_hash = hash_state(ref);
+        for (engine_t e = 0; e < NUM_ENGINES; e++) {
+            if (hash_state(&m->engines[e]) != ref_hash) {
+                outcome.result = RESULT_DIVERGED;
+                outcome.engine = e;
+                return outcome;
+            }
+        }
+    }
+
+    outcome.frame = c->frames;
+    return outcome;
+}
+
+// Random even address in the main loop, at least room bytes before its end
+static uint16_t random_main_target(uint64_t *rng, const layout_t *layout, const uint16_t room) {
+    const int words = (layout->main_end - 0x200 - room) / 2;
+    return 0x200 + 2 * random_below(rng, words > 0 ? words : 1);
+}
+
+// Random I value; sprites, BCD digits & saved registers mostly go to the data area
+static uint16_t random_index(uint64_t *rng, const layout_t *layout) {
+    const uint32_t r = random_below(rng, 16);
+    if (r < 2) return 0x200 + random_below(rng, layout->image_end - 0x200);    // Into the code
+    if (r < 5) return 5 * random_below(rng, 16);                                // Font
+    return layout->data + random_below(rng, FUZZ_DATA_SIZE - 16);
+}
+
+// Random instruction sequence, biased towards valid, in-bounds instructions & fusable sequences.
+//   Calls only go to later subroutines, so the stack never gets deeper than the number of
+//   subroutines; returns are only generated at the end of a subroutine.
+static uint32_t random_instructions(uint64_t *rng, const layout_t *layout, uint8_t out[]) {
+    const uint8_t X = random_below(rng, 16), Y = random_below(rng, 16);
+    const uint8_t NN = next_random(rng) & 0xFF;
+    const bool in_main = layout->sub == layout->num_subs;
+    const uint32_t later_subs = in_main ? layout->num_subs : layout->num_subs - layout->sub - 1;
+    const uint16_t I = 0xA000 | random_index(rng, layout);
+    uint16_t ops[3] = {0};
+    uint32_t count = 1;
+
+    switch (random_below(rng, 26)) {
+        case 0:  ops[0] = 0x00E0; break;
+        case 1:
+        case 2:
+            // 0x2NNN: call a later subroutine; 0x1NNN: jump within the main loop
+            if (later_subs) ops[0] = 0x2000 | layout->subs[layout->num_subs - 1 - random_below(rng, later_subs)];
+            else ops[0] = 0x7000 | X << 8 | NN;
+            break;
+        case 3:
+            ops[0] = in_main ? 0x1000 | random_main_target(rng, layout, 0) : 0x7000 | X << 8 | NN;
+            break;
+        case 4:  ops[0] = 0x3000 | X << 8 | NN; break;
+        case 5:  ops[0] = 0x4000 | X << 8 | NN; break;
+        case 6:  ops[0] = 0x5000 | X << 8 | Y << 4; break;
+        case 7:  ops[0] = 0x6000 | X << 8 | NN; break;
+        case 8:  ops[0] = 0x7000 | X << 8 | NN; break;
+        case 9:  ops[0] = 0x8000 | X << 8 | Y << 4 | (NN & 0x0F); break;
+        case 10: ops[0] = 0x9000 | X << 8 | Y << 4; break;
+        case 11: ops[0] = I; break;
+        case 12: {
+            // 0xBNNN, with V0 (or VX, SUPERCHIP's BXNN) set to a small even offset first
+            if (!in_main) { ops[0] = 0xC000 | X << 8 | NN; break; }
+            const uint16_t target = random_main_target(rng, layout, 8);
+            const uint8_t offset = 2 * random_below(rng, 4);
+            ops[0] = 0x6000 | offset;
+            ops[1] = 0x6000 | (target & 0x0F00) | offset;
+            ops[2] = 0xB000 | target;
+            count = 3;
+            break;
+        }
+        case 13: ops[0] = 0xC000 | X << 8 | NN; break;
+        case 14: ops[0] = 0xD000 | X << 8 | Y << 4 | (NN & 0x0F); break;
+        case 15:
+            // 0xEX9E/0xEXA1, on a key number
+            ops[0] = 0x6000 | X << 8 | (NN & 0x0F);
+            ops[1] = 0xE09E | X << 8 | ((NN & 0x10) ? 0x3F : 0);
+            count = 2;
+            break;
+        case 16: {
+            static const uint8_t fx[] = { 0x07, 0x0A, 0x15, 0x18, 0x29, 0x33, 0x02, 0x3A };
+            ops[0] = 0xF000 | X << 8 | fx[NN % sizeof fx];
+            break;
+        }
+        case 17: {
+            // Instructions that move I, from a known I so it can't creep past the end of ram
+            static const uint8_t fx[] = { 0x1E, 0x55, 0x65 };
+            ops[0] = I;
+            ops[1] = 0xF000 | X << 8 | fx[NN % sizeof fx];
+            count = 2;
+            break;
+        }
+
+        // Fusable sequences
+        case 18: ops[0] = I; ops[1] = 0xD000 | X << 8 | Y << 4 | (NN & 0x0F); count = 2; break;
+        case 19: ops[0] = 0x6000 | Y << 8 | NN; ops[1] = 0x8004 | X << 8 | Y << 4; count = 2; break;
+        case 20: ops[0] = I; ops[1] = 0xF033 | X << 8; ops[2] = 0xF065 | (Y & 3) << 8; count = 3; break;
+        case 21: ops[0] = 0xF015 | X << 8; break;
+        default:
+            // Any opcode, as long as it can't leave the layout
+            ops[0] = next_random(rng) & 0xFFFF;
+            switch (ops[0] >> 12) {
+                case 0x0: if ((ops[0] & 0xFF) == 0xEE) ops[0] = 0x00E0; break;
+                case 0x1: case 0x2: case 0xB: case 0xE: case 0xF: ops[0] = 0x7000 | (ops[0] & 0x0FFF); break;
+                case 0xA: ops[0] = I; break;
+                default: break;
+            }
+            break;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        out[2*i] = ops[i] >> 8;
+        out[2*i + 1] = ops[i] & 0xFF;
+    }
+    return 2 * count;
+}
+
+// Fill rom[start..end-2] with random instructions, then end with two copies of the final
+//   instruction, so a skip just before it can't run past it
+static void random_code(uint64_t *rng, const layout_t *layout, uint8_t rom[], const uint16_t start,
+                        const uint16_t end, const uint16_t final) {
+    for (uint32_t pos = start; pos < end - 4u; ) {
+        uint8_t ops[6];
+        uint32_t length;
+
+        // Timer wait loops jump to themselves, so they are placed here knowing their address
+        if (random_below(rng, 32) == 0 && pos + 6 <= end - 4u) {
+            const uint8_t X = random_below(rng, 16);
+            const uint16_t address = 0x200 + pos;
+            const uint8_t loop[6] = { 0xF0 | X, 0x07, 0x30 | X, 0x00, 0x10 | address >> 8, address & 0xFF };
+            memcpy(ops, loop, sizeof loop);
+            length = sizeof loop;
+        } else {
+            length = random_instructions(rng, layout, ops);
+        }
+
+        if (length > end - 4u - pos) length = end - 4u - pos;
+        memcpy(&rom[pos], ops, length);
+        pos += length;
+    }
+
+    for (uint32_t pos = end - 4u; pos < end; pos += 2) {
+        rom[pos] = final >> 8;
+        rom[pos + 1] = final & 0xFF;
+    }
+}
+
+// Random ROM, input log & configuration. The ROM is a main loop followed by subroutines.
+static void generate_case(worker_t *worker, fuzz_case_t *c) {
+    fuzzer_t *fuzzer = worker->fuzzer;
+    uint64_t *rng = &worker->rng;
+    layout_t *layout = &c->layout;
+
+    // Sizes first, so code can refer to every address in the layout
+    uint16_t sub_sizes[FUZZ_MAX_SUBS];
+    uint16_t end = 0x200 + 2 * (16 + random_below(rng, 400));
+    layout->main_end = end;
+    layout->num_subs = random_below(rng, FUZZ_MAX_SUBS + 1);
+    for (uint32_t i = 0; i < layout->num_subs; i++) {
+        sub_sizes[i] = 2 * (4 + random_below(rng, 60));
+        layout->subs[i] = end;
+        end += sub_sizes[i];
+    }
+    layout->image_end = end;
+    layout->data = end + 2 * random_below(rng, 32);
+    c->rom_size = end - 0x200;
+
+    layout->sub = layout->num_subs;
+    random_code(rng, layout, c->rom, 0, layout->main_end - 0x200, 0x1200);
+    for (layout->sub = 0; layout->sub < layout->num_subs; layout->sub++) {
+        const uint16_t start = layout->subs[layout->sub] - 0x200;
+        random_code(rng, layout, c->rom, start, start + sub_sizes[layout->sub], 0x00EE);
+    }
+    layout->sub = layout->num_subs;     // Mutations insert main loop code anywhere
+
+    c->num_events = random_below(rng, 64);
+    uint64_t frame = 0;
+    for (uint32_t i = 0; i < c->num_events; i++) {
+        frame += random_below(rng, 2 * fuzzer->frames / (c->num_events + 1) + 1);
+        c->events[i] = (input_event_t){
+            .frame = frame,
+            .key = random_below(rng, 16),
+            .pressed = random_below(rng, 2),
+        };
+    }
+
+    static const uint32_t rates[] = { 600, 2000, 20000 };
+    c->config = fuzzer->defaults;
+    c->config.current_extension = random_below(rng, 3);
+    c->config.timing = random_below(rng, 2) ? TIMING_VIP : TIMING_FAST;
+    c->config.insts_per_second = rates[random_below(rng, 3)];
+    c->config.rng_seed = next_random(rng) | 1;
+    c->frames = fuzzer->frames;
+}
+
+// Mutate a ROM from the corpus or the previous case: bit flips, byte & instruction changes,
+//   copied or cleared chunks; the input log & configuration are generated fresh
+static void mutate_case(worker_t *worker, fuzz_case_t *c) {
+    fuzzer_t *fuzzer = worker->fuzzer;
+    uint64_t *rng = &worker->rng;
+    uint8_t rom[FUZZ_MAX_ROM];
+    uint32_t rom_size;
+    layout_t layout;
+
+    if (fuzzer->num_corpus && (!worker->have_previous || random_below(rng, 2))) {
+        // Corpus ROMs have no known layout, treat them as one big main loop
+        const uint32_t i = random_below(rng, fuzzer->num_corpus);
+        rom_size = fuzzer->corpus_size[i];
+        memcpy(rom, fuzzer->corpus[i], rom_size);
+        layout = (layout_t){ .main_end = 0x200 + rom_size, .image_end = 0x200 + rom_size };
+        layout.data = layout.image_end <= 0x1000 - FUZZ_DATA_SIZE ? layout.image_end : 0x1000 - FUZZ_DATA_SIZE;
+    } else {
+        rom_size = worker->previous.rom_size;
+        memcpy(rom, worker->previous.rom, rom_size);
+        layout = worker->previous.layout;
+    }
+
+    generate_case(worker, c);   // Fresh input & configuration
+    memcpy(c->rom, rom, rom_size);
+    c->rom_size = rom_size;
+    c->layout = layout;
+    if (rom_size < 2) return;
+
+    // Mostly whole instructions, occasionally raw bytes
+    const uint32_t mutations = 1 + random_below(rng, 4);
+    for (uint32_t m = 0; m < mutations; m++) {
+        const uint32_t pos = random_below(rng, rom_size);
+        const uint32_t length = 1 + random_below(rng, rom_size - pos < 32 ? rom_size - pos : 32);
+
+        switch (random_below(rng, 8)) {
+            case 0: c->rom[pos] ^= 1 << random_below(rng, 8); break;
+            case 1: c->rom[pos] = next_random(rng) & 0xFF; break;
+            case 2: {
+                const uint32_t from = random_below(rng, rom_size - length + 1) & ~1u;
+                memmove(&c->rom[pos & ~1u], &c->rom[from], length & ~1u);
+                break;
+            }
+            case 3: memset(&c->rom[pos], 0, length); break;
+            default: {
+                uint8_t ops[6];
+                const uint32_t n = random_instructions(rng, &c->layout, ops);
+                for (uint32_t i = 0; i < n && (pos & ~1u) + i < rom_size; i++)
+                    c->rom[(pos & ~1u) + i] = ops[i];
+                break;
+            }
+        }
+    }
+}
+
+// Delta debugging: clear as many instructions (to 0x0000, a no-op) and drop as many input events
+//   as possible while the case still diverges
+static void minimize_case(worker_t *worker, fuzz_case_t *c, const outcome_t *outcome) {
+    const uint32_t check_every = worker->fuzzer->check_every;
+    fuzz_case_t *candidate = &worker->minimized;
+    uint16_t units[FUZZ_MAX_ROM / 2];
+
+    c->frames = outcome->frame + 1;     // Nothing after the divergent frame matters
+
+    // Instructions: ddmin over the non-zero instruction words
+    for (uint32_t n = 2; ; ) {
+        uint32_t num_units = 0;
+        for (uint32_t i = 0; i + 1 < c->rom_size; i += 2)
+            if (c->rom[i] || c->rom[i + 1]) units[num_units++] = i;
+        if (num_units < 2) break;
+        if (n > num_units) n = num_units;
+
+        const uint32_t chunk = (num_units + n - 1) / n;
+        bool reduced = false;
+        for (uint32_t start = 0; start < num_units && !reduced; start += chunk) {
+            *candidate = *c;
+            for (uint32_t i = start; i < start + chunk && i < num_units; i++)
+                candidate->rom[units[i]] = candidate->rom[units[i] + 1] = 0;
+
+            if (run_case(candidate, check_every, &worker->machines, NULL).result == RESULT_DIVERGED) {
+                *c = *candidate;
+                n = n > 2 ? n - 1 : 2;
+                reduced = true;
+            }
+        }
+
+        if (!reduced) {
+            if (n == num_units) break;
+            n = 2 * n < num_units ? 2 * n : num_units;
+        }
+    }
+
+    // Input events: drop one at a time, from the end
+    for (uint32_t i = c->num_events; i-- > 0; ) {
+        *candidate = *c;
+        memmove(&candidate->events[i], &candidate->events[i + 1], (candidate->num_events - i - 1) * sizeof candidate->events[0]);
+        candidate->num_events--;
+        if (run_case(candidate, check_every, &worker->machines, NULL).result == RESULT_DIVERGED)
+            *c = *candidate;
+    }
+
+    // Trailing cleared instructions
+    while (c->rom_size >= 2 && c->rom[c->rom_size - 1] == 0 && c->rom[c->rom_size - 2] == 0) {
+        *candidate = *c;
+        candidate->rom_size -= 2;
+        if (run_case(candidate, check_every, &worker->machines, NULL).result != RESULT_DIVERGED) break;
+        *c = *candidate;
+    }
+}
+
+// Write the minimized ROM and input log, and describe how to reproduce the divergence
+static void report_divergence(worker_t *worker, const fuzz_case_t *c, const outcome_t *outcome) {
+    fuzzer_t *fuzzer = worker->fuzzer;
+    const int report = SDL_AtomicAdd(&fuzzer->reports, 1);
+    char rom_path[1024], input_path[1024];
+
+    snprintf(rom_path, sizeof rom_path, "%s%d.ch8", fuzzer->out_prefix, report);
+    snprintf(input_path, sizeof input_path, "%s%d.input", fuzzer->out_prefix, report);
+
+    FILE *file = fopen(rom_path, "wb");
+    if (file) {
+        fwrite(c->rom, 1, c->rom_size, file);
+        fclose(file);
+    }
+
+    file = fopen(input_path, "w");
+    if (file) {
+        fprintf(file, "# <frame> <key> <1 pressed|0 released>\n");
+        for (uint32_t i = 0; i < c->num_events; i++)
+            fprintf(file, "%llu %X %d\n", (long long unsigned)c->events[i].frame, c->events[i].key, c->events[i].pressed);
+        fclose(file);
+    }
+
+    static const char *extensions[] = { "CHIP8", "SUPERCHIP", "XOCHIP" };
+    SDL_LockMutex(fuzzer->lock);
+    printf("Divergence: %s engine at frame %llu, after %llu reference instructions\n",
+           engine_names[outcome->engine], (long long unsigned)outcome->frame,
+           (long long unsigned)outcome->instructions);
+    printf("  minimized to %u byte ROM %s, %u input events %s\n", c->rom_size, rom_path, c->num_events, input_path);
+    printf("  config: extension %s, timing %s, %u instructions/s, seed %u, %u frames\n",
+           extensions[c->config.current_extension], c->config.timing == TIMING_VIP ? "vip" : "fast",
+           c->config.insts_per_second, c->config.rng_seed, c->frames);
+    fflush(stdout);
+    SDL_UnlockMutex(fuzzer->lock);
+}
+
+static int fuzz_thread(void *data) {
+    worker_t *worker = data;
+    fuzzer_t *fuzzer = worker->fuzzer;
+    uint64_t instructions = 0, frames_reached = 0;
+
+    while (SDL_GetPerformanceCounter() < fuzzer->deadline) {
+        const uint64_t case_number = (uint32_t)SDL_AtomicAdd(&fuzzer->cases, 1);
+        if (fuzzer->max_cases && case_number >= fuzzer->max_cases) break;
+
+        // Half the cases mutate an earlier ROM, half are new
+        if ((worker->have_previous || fuzzer->num_corpus) && random_below(&worker->rng, 2))
+            mutate_case(worker, &worker->current);
+        else
+            generate_case(worker, &worker->current);
+
+        const outcome_t outcome = run_case(&worker->current, fuzzer->check_every, &worker->machines, &worker->profile);
+        instructions += outcome.instructions;
+        frames_reached += outcome.frame;
+
+        if (outcome.result == RESULT_UNSAFE) {
+            SDL_AtomicAdd(&fuzzer->unsafe, 1);
+        } else if (outcome.result == RESULT_DIVERGED) {
+            SDL_AtomicAdd(&fuzzer->divergences, 1);
+            if (SDL_AtomicGet(&fuzzer->reports) < FUZZ_MAX_REPORTS) {
+                minimize_case(worker, &worker->current, &outcome);
+                report_divergence(worker, &worker->current, &outcome);
+            }
+            continue;
+        }
+
+        worker->previous = worker->current;
+        worker->have_previous = true;
+    }
+
+    SDL_LockMutex(fuzzer->lock);
+    fuzzer->instructions += instructions;
+    fuzzer->frames_reached += frames_reached;
+    for (fusion_t f = FUSION_NONE + 1; f < FUSION_COUNT; f++)
+        fuzzer->fusions += worker->profile.fusions[f];
+    fuzzer->skipped_waits += worker->profile.skipped_waits;
+    SDL_UnlockMutex(fuzzer->lock);
+    return 0;
+}
+
+// Load a ROM into the mutation corpus
+static bool load_corpus(fuzzer_t *fuzzer, const char path[]) {
+    if (fuzzer->num_corpus == FUZZ_MAX_CORPUS) return true;
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open corpus ROM %s\n", path);
+        return false;
+    }
+    const size_t size = fread(fuzzer->corpus[fuzzer->num_corpus], 1, FUZZ_MAX_ROM, file);
+    fclose(file);
+
+    fuzzer->corpus_size[fuzzer->num_corpus++] = size & ~1u;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    static fuzzer_t fuzzer;
+    char *no_args[] = { argv[0] };
+
+    set_config_from_args(&fuzzer.defaults, 1, no_args);
+    fuzzer.threads = SDL_GetCPUCount();
+    fuzzer.seconds = 60;
+    fuzzer.check_every = 1000;
+    fuzzer.frames = 60;
+    fuzzer.seed = (uint64_t)time(NULL);
+    fuzzer.out_prefix = "fuzz-";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            fuzzer.threads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            fuzzer.seconds = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cases") == 0 && i + 1 < argc) {
+            fuzzer.max_cases = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--check-every") == 0 && i + 1 < argc) {
+            fuzzer.check_every = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            fuzzer.frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            fuzzer.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            fuzzer.out_prefix = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--threads N] [--seconds N] [--cases N] [--check-every N] "
+                            "[--frames N] [--seed N] [--out PREFIX] [corpus.ch8 ...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        } else if (!load_corpus(&fuzzer, argv[i])) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (fuzzer.threads == 0) fuzzer.threads = 1;
+    if (fuzzer.check_every == 0) fuzzer.check_every = 1;
+
+    worker_t *workers = calloc(fuzzer.threads, sizeof *workers);
+    SDL_Thread **threads = calloc(fuzzer.threads, sizeof *threads);
+    fuzzer.lock = SDL_CreateMutex();
+    if (!workers || !threads || !fuzzer.lock) {
+        fprintf(stderr, "Could not allocate fuzzer workers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Fuzzing with %u threads for %us, seed %llu\n", fuzzer.threads, fuzzer.seconds,
+           (long long unsigned)fuzzer.seed);
+
+    const uint64_t start_time = SDL_GetPerformanceCounter();
+    fuzzer.deadline = start_time + (uint64_t)fuzzer.seconds * SDL_GetPerformanceFrequency();
+
+    for (uint32_t i = 0; i < fuzzer.threads; i++) {
+        workers[i].fuzzer = &fuzzer;
+        workers[i].id = i;
+        workers[i].rng = (fuzzer.seed + 1) * 0x9E3779B97F4A7C15ULL + i;
+        threads[i] = SDL_CreateThread(fuzz_thread, "CHIP8 Fuzz Worker", &workers[i]);
+        if (!threads[i]) {
+            fprintf(stderr, "Could not create fuzzer thread %s\n", SDL_GetError());
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < fuzzer.threads; i++)
+        SDL_WaitThread(threads[i], NULL);
+
+    const double seconds = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+    const uint64_t cases = fuzzer.max_cases && (uint64_t)SDL_AtomicGet(&fuzzer.cases) > fuzzer.max_cases ?
+                           fuzzer.max_cases : (uint64_t)SDL_AtomicGet(&fuzzer.cases);
+    const int unsafe = SDL_AtomicGet(&fuzzer.unsafe);
+    printf("%llu cases, %llu instructions in %.1fs (%.2fM instructions/s/thread), %d stopped as unsafe (%.1f%%), %d divergent\n",
+           (long long unsigned)cases, (long long unsigned)fuzzer.instructions, seconds,
+           fuzzer.instructions / seconds / fuzzer.threads / 1e6,
+           unsafe, cases ? 100.0 * unsafe / cases : 0.0, SDL_AtomicGet(&fuzzer.divergences));
+    printf("Per case: %.0f instructions, %.1f of %u frames; fused engine ran %llu superinstructions, skipped %llu timer waits\n",
+           cases ? (double)fuzzer.instructions / cases : 0.0, cases ? (double)fuzzer.frames_reached / cases : 0.0,
+           fuzzer.frames, (long long unsigned)fuzzer.fusions, (long long unsigned)fuzzer.skipped_waits);
+
+    free(workers);
+    free(threads);
+    SDL_DestroyMutex(fuzzer.lock);
+    exit(SDL_AtomicGet(&fuzzer.divergences) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
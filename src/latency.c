@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+static const char *stage_names[LATENCY_STAGES] = { "key_to_observe", "key_to_draw", "key_to_present" };
+
+bool start_latency(latency_t *latency) {
+    memset(latency, 0, sizeof *latency);
+
+    latency->lock = SDL_CreateMutex();
+    if (!latency->lock) {
+        SDL_Log("Could not create latency tracker lock %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// Input thread: timestamp a CHIP8 keypad keydown
+void latency_keydown(latency_t *latency, const uint8_t key) {
+    const uint64_t now = SDL_GetPerformanceCounter();
+
+    SDL_LockMutex(latency->lock);
+    if (latency->pressed[key] == 0) latency->pressed[key] = now;
+    SDL_UnlockMutex(latency->lock);
+}
+
+// Emulation thread, start of frame: start probes for keys pressed since the last frame.
+//   A new press of a key replaces a probe still in flight for it.
+void latency_latch(latency_t *latency) {
+    SDL_LockMutex(latency->lock);
+    for (uint8_t i = 0; i < 16; i++) {
+        if (latency->pressed[i] == 0) continue;
+        latency->keys[i] = (latency_probe_t){ .keydown = latency->pressed[i] };
+        latency->pressed[i] = 0;
+    }
+    SDL_UnlockMutex(latency->lock);
+}
+
+// Emulation thread: ROM read the key (EX9E/EXA1/FX0A) while it was pressed
+void latency_observe(latency_t *latency, const uint8_t key) {
+    latency_probe_t *probe = &latency->keys[key & 0x0F];
+    if (probe->keydown && !probe->observed)
+        probe->observed = SDL_GetPerformanceCounter();
+}
+
+// Emulation thread: ROM drew a sprite, completing probes for every key it observed
+void latency_draw(latency_t *latency) {
+    for (uint8_t i = 0; i < 16; i++) {
+        latency_probe_t *probe = &latency->keys[i];
+        if (!probe->observed) continue;
+
+        probe->drawn = SDL_GetPerformanceCounter();
+        if (latency->num_drawn < LATENCY_MAX_PROBES)
+            latency->drawn[latency->num_drawn++] = *probe;
+        *probe = (latency_probe_t){0};
+    }
+}
+
+// Emulation thread: attach drawn probes to the frame being published
+void latency_publish(latency_t *latency, frame_t *frame) {
+    memcpy(frame->probes, latency->drawn, latency->num_drawn * sizeof latency->drawn[0]);
+    frame->num_probes = latency->num_drawn;
+    latency->num_drawn = 0;
+}
+
+// Emulation thread: a published frame was replaced before the render thread took it. Put its
+//   probes back in front of any drawn since, to go out with the next published frame; dropping
+//   them would lose exactly the samples behind slow presents.
+void latency_requeue(latency_t *latency, const frame_t *frame) {
+    uint32_t count = frame->num_probes;
+    if (count > LATENCY_MAX_PROBES - latency->num_drawn) count = LATENCY_MAX_PROBES - latency->num_drawn;
+
+    memmove(&latency->drawn[count], latency->drawn, latency->num_drawn * sizeof latency->drawn[0]);
+    memcpy(latency->drawn, frame->probes, count * sizeof latency->drawn[0]);
+    latency->num_drawn += count;
+}
+
+// Render thread: frame was just presented, record its probes
+void latency_present(latency_t *latency, const frame_t *frame) {
+    if (frame->num_probes == 0) return;
+
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+
+    for (uint32_t i = 0; i < frame->num_probes; i++) {
+        const latency_probe_t *probe = &frame->probes[i];
+        const uint64_t done[LATENCY_STAGES] = { probe->observed, probe->drawn, now };
+
+        for (uint32_t stage = 0; stage < LATENCY_STAGES; stage++) {
+            const double ms = (done[stage] - probe->keydown) * ms_per_tick;
+            const uint32_t bucket = ms < LATENCY_BUCKETS - 1 ? (uint32_t)ms : LATENCY_BUCKETS - 1;
+
+            latency->histogram[stage][bucket]++;
+            latency->total_ms[stage] += ms;
+            if (ms > latency->max_ms[stage]) latency->max_ms[stage] = ms;
+        }
+        latency->count++;
+    }
+}
+
+// Histogram bucket (ms) at or below which the given fraction of samples fall
+static uint32_t percentile(const uint32_t histogram[], const uint64_t count, const double fraction) {
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= fraction * count) return i;
+    }
+    return LATENCY_BUCKETS - 1;
+}
+
+// Log a summary and write the session's histograms as CSV
+void report_latency(latency_t *latency, const char path[]) {
+    SDL_DestroyMutex(latency->lock);
+
+    if (latency->count == 0) {
+        SDL_Log("Latency: no keypresses were observed and drawn\n");
+        return;
+    }
+
+    for (uint32_t stage = 0; stage < LATENCY_STAGES; stage++)
+        SDL_Log("Latency %s: %llu samples, mean %.1fms, p50 %ums, p95 %ums, max %.1fms\n",
+                stage_names[stage], (long long unsigned)latency->count,
+                latency->total_ms[stage] / latency->count,
+                percentile(latency->histogram[stage], latency->count, 0.50),
+                percentile(latency->histogram[stage], latency->count, 0.95),
+                latency->max_ms[stage]);
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        SDL_Log("Could not open latency histogram file %s\n", path);
+        return;
+    }
+
+    // One row per 1ms bucket, the last bucket also holds anything slower
+    fprintf(file, "bucket_ms,%s,%s,%s\n", stage_names[0], stage_names[1], stage_names[2]);
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+        fprintf(file, "%u,%u,%u,%u\n", i, latency->histogram[LATENCY_OBSERVE][i],
+                latency->histogram[LATENCY_DRAW][i], latency->histogram[LATENCY_PRESENT][i]);
+
+    fclose(file);
+}
@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include "chip8.h"
 
 int main(int argc, char **argv) {
@@ -14,59 +13,67 @@ int main(int argc, char **argv) {
     config_t config = {0};
     if (!set_config_from_args(&config, argc, argv)) exit(EXIT_FAILURE);
 
+    static emulator_t emu = {0};    // Static, too big for the stack
+
+    // Headless export, no window or audio device
+    if (config.export_file) {
+        emu.config = config;
+        exit(run_export(&emu, argv[1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     // Initialize SDL
     sdl_t sdl = {0};
-    if (!init_sdl(&sdl, &config)) exit(EXIT_FAILURE);
+    if (!init_sdl(&sdl, &config, &emu.audio)) exit(EXIT_FAILURE);
 
     // Initialize CHIP8 machine
-    chip8_t chip8 = {0};
     const char *rom_name = argv[1];
-    if (!init_chip8(&chip8, config, rom_name)) exit(EXIT_FAILURE);
+    emu.config = config;
+    if (!init_chip8(&emu.chip8, config, rom_name)) exit(EXIT_FAILURE);
 
     // Initial screen clear to background color
     clear_screen(sdl, config);
 
-    // Seed random number generator
-    srand(time(NULL));
-
-    // Main emulator loop
-    while (chip8.state != QUIT) {
-        // Handle user input
-        handle_input(&chip8, &config);
-
-        if (chip8.state == PAUSED) continue;
+    // Init pixels to bg color, these are lerped towards the fg/bg color as pixels are drawn
+    uint32_t pixel_color[64*32];
+    for (uint32_t i = 0; i < sizeof pixel_color / sizeof pixel_color[0]; i++)
+        pixel_color[i] = config.bg_color;
 
-        // Get time before running instructions
-        const uint64_t start_frame_time = SDL_GetPerformanceCounter();
+    // Start execution trace writer
+    if (config.trace_file && !start_trace(&emu.trace, config.trace_file)) exit(EXIT_FAILURE);
 
-        // Emulate CHIP8 Instructions for this emulator "frame" (60hz)
-        for (uint32_t i = 0; i < config.insts_per_second / 60; i++) {
-            emulate_instruction(&chip8, config);
+    // Start input latency tracker
+    if (config.latency_file && !start_latency(&emu.latency)) exit(EXIT_FAILURE);
 
-            // If drawing on CHIP8, only draw 1 sprite this frame (display wait)
-            if ((config.current_extension == CHIP8) &&
-                (chip8.inst.opcode >> 12 == 0xD))
-                break;
-        }
-
-        // Get time elapsed after running instructions
-        const uint64_t end_frame_time = SDL_GetPerformanceCounter();
-
-        // Delay for approximately 60hz/60fps (16.67ms) or actual time elapsed
-        const double time_elapsed = (double)((end_frame_time - start_frame_time) * 1000) / SDL_GetPerformanceFrequency();
+    // Start debugger console
+    if (config.debugger && !start_debugger(&emu.debugger)) exit(EXIT_FAILURE);
 
-        SDL_Delay(16.67f > time_elapsed ? 16.67f - time_elapsed : 0);
+    // Run the emulator core on its own thread, this thread handles input & rendering
+    if (!start_emulator_thread(&emu)) exit(EXIT_FAILURE);
 
-        // Update window with changes every 60hz
-        if (chip8.draw) {
-          update_screen(sdl, config, &chip8);
-          chip8.draw = false;
+    // Main render loop
+    while (SDL_AtomicGet(&emu.state) != QUIT) {
+        // Handle user input
+        handle_input(&emu, &config, pixel_color);
+
+        // Present the newest completed frame, if any; blocks on vsync
+        const frame_t *frame = triple_buffer_read_frame(&emu.frames);
+        if (frame) {
+            update_screen(sdl, config, frame->display, pixel_color, config.profile ? &emu.profile : NULL);
+            if (config.latency_file) latency_present(&emu.latency, frame);
+        } else {
+            SDL_Delay(1);
         }
-
-        // Update delay & sound timers every 60hz
-        update_timers(sdl, &chip8);
     }
 
+    stop_emulator_thread(&emu);
+    if (config.trace_file) stop_trace(&emu.trace);
+    if (config.debugger) stop_debugger(&emu.debugger);
+    if (config.latency_file) report_latency(&emu.latency, config.latency_file);
+    report_run_ahead(&emu.ahead);
+    if (config.profile) report_profile(&emu.profile);
+    if (SDL_AtomicGet(&emu.audio.underruns) > 0)
+        SDL_Log("Audio: %d buffer underruns\n", SDL_AtomicGet(&emu.audio.underruns));
+
     // Final cleanup
     final_cleanup(sdl);
 
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+// Run-ahead: Snapshot the real machine, emulate config.run_ahead_frames frames past it using
+//   the current input, copy out the display that results, then restore the snapshot.
+//   Games usually take 1-2 frames to react to a key (FX0A release wait, delay timer polling),
+//   presenting the run-ahead display hides that latency.
+// Returns true if the run-ahead display changed and should be redrawn
+bool run_ahead(chip8_t *chip8, const config_t config, bool display[], run_ahead_t *ahead) {
+    const uint64_t start_time = SDL_GetPerformanceCounter();
+
+    // All machine state lives inside chip8_t ahead of the decode cache, so copying up to it is a
+    //   full snapshot. stack_ptr points into chip8->stack, which stays valid as we restore into
+    //   the same object. The 40KB decode cache is shared with the speculative frames instead.
+    const size_t state_size = offsetof(chip8_t, decoded);
+    memcpy(&ahead->snapshot, chip8, state_size);
+    chip8->audio = NULL;    // Speculative frames never render audio,
+    chip8->trace = NULL;    //   nor show up in execution traces
+    chip8->profile = NULL;  //   or the instruction profile,
+    chip8->latency = NULL;  //   and don't observe or draw latency probes, restoring can't undo that
+
+    for (uint32_t i = 0; i < config.run_ahead_frames; i++)
+        emulate_frame(chip8, config);
+
+    // Draw flag includes the real frame's draw, as run-ahead starts from the real state
+    const bool draw = chip8->draw;
+    if (draw)
+        memcpy(display, chip8->display, sizeof chip8->display);
+
+    // Instructions decoded from ram the speculative frames wrote are stale once it's restored
+    for (uint16_t address = 0; address < sizeof chip8->ram; address++) {
+        if (chip8->ram[address] == ahead->snapshot.ram[address]) continue;
+
+        uint16_t length = 1;
+        while (address + length < sizeof chip8->ram &&
+               chip8->ram[address + length] != ahead->snapshot.ram[address + length])
+            length++;
+        invalidate_decoded(chip8, address, length);
+        address += length;
+    }
+
+    memcpy(chip8, &ahead->snapshot, state_size);
+
+    // CPU cost accounting
+    const uint64_t ticks = SDL_GetPerformanceCounter() - start_time;
+    ahead->frames++;
+    ahead->total_ticks += ticks;
+    if (ticks > ahead->max_ticks) ahead->max_ticks = ticks;
+
+    return draw;
+}
+
+// Print CPU cost of run-ahead, relative to the 60hz (16.67ms) frame budget
+void report_run_ahead(const run_ahead_t *ahead) {
+    if (ahead->frames == 0) return;
+
+    const double freq = (double)SDL_GetPerformanceFrequency();
+    const double avg_ms = (ahead->total_ticks * 1000.0 / freq) / ahead->frames;
+    const double max_ms = ahead->max_ticks * 1000.0 / freq;
+
+    SDL_Log("Run-ahead: %llu frames, avg %.3fms (%.1f%% of frame budget), max %.3fms\n",
+            (long long unsigned)ahead->frames, avg_ms, avg_ms / 16.67 * 100.0, max_ms);
+}
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Pixel art upscalers, from rows of RGBA8888 pixel colors into a texture.
+//   Kernels run SSE2 on 4 packed pixels at a time where available, with a scalar tail/fallback.
+
+// Upscale factor of each filter's output, FILTER_RECTS draws rectangles instead
+uint32_t filter_scale(const filter_t filter) {
+    switch (filter) {
+        case FILTER_NEAREST: return 1;  // Renderer scales up with nearest sampling
+        case FILTER_SCALE2X: return 2;
+        case FILTER_SCALE3X: return 3;
+        case FILTER_SCALE4X: return 4;
+        case FILTER_CRT:     return 4;
+        default:             return 1;
+    }
+}
+
+// Copy a row into pad[1..w], repeating the edge pixels into pad[0] and pad[w+1]
+static void pad_row(const uint32_t row[], const uint32_t w, uint32_t pad[]) {
+    pad[0] = row[0];
+    memcpy(&pad[1], row, w * sizeof row[0]);
+    pad[w + 1] = row[w - 1];
+}
+
+#ifdef __SSE2__
+// mask ? a : b
+static inline __m128i select_si128(const __m128i mask, const __m128i a, const __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+// Scale2x/EPX: each pixel E becomes 2x2, corners take a neighbour's color along clean diagonal edges
+//     B        E0 E1
+//   D E F  ->  E2 E3
+//     H
+static void scale2x(const uint32_t src[], const uint32_t w, const uint32_t h, const uint32_t src_pitch,
+                    uint32_t dst[], const uint32_t dst_pitch) {
+    uint32_t pad[SCALER_MAX_WIDTH * 2 + 2];
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint32_t *up = &src[(y > 0 ? y - 1 : y) * src_pitch];
+        const uint32_t *down = &src[(y + 1 < h ? y + 1 : y) * src_pitch];
+        uint32_t *out0 = &dst[(2 * y) * dst_pitch];
+        uint32_t *out1 = &dst[(2 * y + 1) * dst_pitch];
+        uint32_t x = 0;
+
+        pad_row(&src[y * src_pitch], w, pad);
+
+#ifdef __SSE2__
+        for (; x + 4 <= w; x += 4) {
+            const __m128i B = _mm_loadu_si128((const __m128i *)&up[x]);
+            const __m128i H = _mm_loadu_si128((const __m128i *)&down[x]);
+            const __m128i D = _mm_loadu_si128((const __m128i *)&pad[x]);
+            const __m128i E = _mm_loadu_si128((const __m128i *)&pad[x + 1]);
+            const __m128i F = _mm_loadu_si128((const __m128i *)&pad[x + 2]);
+
+            const __m128i DB = _mm_cmpeq_epi32(D, B);
+            const __m128i BF = _mm_cmpeq_epi32(B, F);
+            const __m128i DH = _mm_cmpeq_epi32(D, H);
+            const __m128i HF = _mm_cmpeq_epi32(H, F);
+
+            const __m128i E0 = select_si128(_mm_andnot_si128(_mm_or_si128(BF, DH), DB), D, E);
+            const __m128i E1 = select_si128(_mm_andnot_si128(_mm_or_si128(DB, HF), BF), F, E);
+            const __m128i E2 = select_si128(_mm_andnot_si128(_mm_or_si128(DB, HF), DH), D, E);
+            const __m128i E3 = select_si128(_mm_andnot_si128(_mm_or_si128(DH, BF), HF), F, E);
+
+            // Interleave into output rows: E0 E1 E0 E1 ..., E2 E3 E2 E3 ...
+            _mm_storeu_si128((__m128i *)&out0[2 * x],     _mm_unpacklo_epi32(E0, E1));
+            _mm_storeu_si128((__m128i *)&out0[2 * x + 4], _mm_unpackhi_epi32(E0, E1));
+            _mm_storeu_si128((__m128i *)&out1[2 * x],     _mm_unpacklo_epi32(E2, E3));
+            _mm_storeu_si128((__m128i *)&out1[2 * x + 4], _mm_unpackhi_epi32(E2, E3));
+        }
+#endif
+
+        for (; x < w; x++) {
+            const uint32_t B = up[x], H = down[x];
+            const uint32_t D = pad[x], E = pad[x + 1], F = pad[x + 2];
+
+            out0[2 * x]     = (D == B && B != F && D != H) ? D : E;
+            out0[2 * x + 1] = (B == F && B != D && F != H) ? F : E;
+            out1[2 * x]     = (D == H && D != B && H != F) ? D : E;
+            out1[2 * x + 1] = (H == F && D != H && B != F) ? F : E;
+        }
+    }
+}
+
+// Scale3x/AdvMAME3x: each pixel E becomes 3x3, using all 8 neighbours
+//   A B C        E0 E1 E2
+//   D E F   ->   E3 E4 E5
+//   G H I        E6 E7 E8
+static void scale3x(const uint32_t src[], const uint32_t w, const uint32_t h,
+                    uint32_t dst[], const uint32_t dst_pitch) {
+    uint32_t up[SCALER_MAX_WIDTH + 2], mid[SCALER_MAX_WIDTH + 2], down[SCALER_MAX_WIDTH + 2];
+
+    for (uint32_t y = 0; y < h; y++) {
+        uint32_t *out[3] = {
+            &dst[(3 * y) * dst_pitch], &dst[(3 * y + 1) * dst_pitch], &dst[(3 * y + 2) * dst_pitch],
+        };
+        uint32_t x = 0;
+
+        pad_row(&src[(y > 0 ? y - 1 : y) * w], w, up);
+        pad_row(&src[y * w], w, mid);
+        pad_row(&src[(y + 1 < h ? y + 1 : y) * w], w, down);
+
+#ifdef __SSE2__
+        for (; x + 4 <= w; x += 4) {
+            const __m128i A = _mm_loadu_si128((const __m128i *)&up[x]);
+            const __m128i B = _mm_loadu_si128((const __m128i *)&up[x + 1]);
+            const __m128i C = _mm_loadu_si128((const __m128i *)&up[x + 2]);
+            const __m128i D = _mm_loadu_si128((const __m128i *)&mid[x]);
+            const __m128i E = _mm_loadu_si128((const __m128i *)&mid[x + 1]);
+            const __m128i F = _mm_loadu_si128((const __m128i *)&mid[x + 2]);
+            const __m128i G = _mm_loadu_si128((const __m128i *)&down[x]);
+            const __m128i H = _mm_loadu_si128((const __m128i *)&down[x + 1]);
+            const __m128i I = _mm_loadu_si128((const __m128i *)&down[x + 2]);
+
+            const __m128i DB = _mm_cmpeq_epi32(D, B);
+            const __m128i BF = _mm_cmpeq_epi32(B, F);
+            const __m128i DH = _mm_cmpeq_epi32(D, H);
+            const __m128i HF = _mm_cmpeq_epi32(H, F);
+            const __m128i EA = _mm_cmpeq_epi32(E, A);
+            const __m128i EC = _mm_cmpeq_epi32(E, C);
+            const __m128i EG = _mm_cmpeq_epi32(E, G);
+            const __m128i EI = _mm_cmpeq_epi32(E, I);
+
+            // Edge conditions shared by Scale2x, then each one extended with a diagonal check
+            const __m128i top_left     = _mm_andnot_si128(_mm_or_si128(BF, DH), DB);
+            const __m128i top_right    = _mm_andnot_si128(_mm_or_si128(DB, HF), BF);
+            const __m128i bottom_left  = _mm_andnot_si128(_mm_or_si128(DB, HF), DH);
+            const __m128i bottom_right = _mm_andnot_si128(_mm_or_si128(DH, BF), HF);
+
+            __m128i E_out[9];
+            E_out[0] = select_si128(top_left, D, E);
+            E_out[1] = select_si128(_mm_or_si128(_mm_andnot_si128(EC, top_left),
+                                                 _mm_andnot_si128(EA, top_right)), B, E);
+            E_out[2] = select_si128(top_right, F, E);
+            E_out[3] = select_si128(_mm_or_si128(_mm_andnot_si128(EG, top_left),
+                                                 _mm_andnot_si128(EA, bottom_left)), D, E);
+            E_out[4] = E;
+            E_out[5] = select_si128(_mm_or_si128(_mm_andnot_si128(EI, top_right),
+                                                 _mm_andnot_si128(EC, bottom_right)), F, E);
+            E_out[6] = select_si128(bottom_left, D, E);
+            E_out[7] = select_si128(_mm_or_si128(_mm_andnot_si128(EI, bottom_left),
+                                                 _mm_andnot_si128(EG, bottom_right)), H, E);
+            E_out[8] = select_si128(bottom_right, F, E);
+
+            // SSE2 has no 3-way interleave, scatter the 9 result vectors
+            uint32_t result[9][4];
+            for (int i = 0; i < 9; i++) _mm_storeu_si128((__m128i *)result[i], E_out[i]);
+            for (int p = 0; p < 4; p++)
+                for (int row = 0; row < 3; row++)
+                    for (int col = 0; col < 3; col++)
+                        out[row][3 * (x + p) + col] = result[row * 3 + col][p];
+        }
+#endif
+
+        for (; x < w; x++) {
+            const uint32_t A = up[x],   B = up[x + 1],   C = up[x + 2];
+            const uint32_t D = mid[x],  E = mid[x + 1],  F = mid[x + 2];
+            const uint32_t G = down[x], H = down[x + 1], I = down[x + 2];
+
+            const bool top_left     = D == B && B != F && D != H;
+            const bool top_right    = B == F && B != D && F != H;
+            const bool bottom_left  = D == H && D != B && H != F;
+            const bool bottom_right = H == F && D != H && B != F;
+
+            out[0][3 * x]     = top_left ? D : E;
+            out[0][3 * x + 1] = ((top_left && E != C) || (top_right && E != A)) ? B : E;
+            out[0][3 * x + 2] = top_right ? F : E;
+            out[1][3 * x]     = ((top_left && E != G) || (bottom_left && E != A)) ? D : E;
+            out[1][3 * x + 1] = E;
+            out[1][3 * x + 2] = ((top_right && E != I) || (bottom_right && E != C)) ? F : E;
+            out[2][3 * x]     = bottom_left ? D : E;
+            out[2][3 * x + 1] = ((bottom_left && E != I) || (bottom_right && E != G)) ? H : E;
+            out[2][3 * x + 2] = bottom_right ? F : E;
+        }
+    }
+}
+
+// CRT: each pixel becomes 4x4, the 4th row is a dark scanline (50%) and the 4th column a
+//   dimmer (75%) aperture grille gap
+#define RGBA_OPAQUE 0x000000FF
+static void crt(const uint32_t src[], const uint32_t w, const uint32_t h,
+                uint32_t dst[], const uint32_t dst_pitch) {
+    for (uint32_t y = 0; y < h; y++) {
+        const uint32_t *row = &src[y * w];
+        uint32_t *out = &dst[(4 * y) * dst_pitch];
+        uint32_t *scanline = &dst[(4 * y + 3) * dst_pitch];
+        uint32_t x = 0;
+
+#ifdef __SSE2__
+        const __m128i opaque = _mm_set1_epi32(RGBA_OPAQUE);
+        const __m128i gap_lane = _mm_set_epi32(-1, 0, 0, 0);   // Lane 3 of each 4 pixel cell row
+
+        for (; x + 4 <= w; x += 4) {
+            const __m128i c = _mm_loadu_si128((const __m128i *)&row[x]);
+            const __m128i half = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 1), _mm_set1_epi32(0x7F7F7F7F)), opaque);
+            const __m128i dim = _mm_or_si128(_mm_sub_epi32(c, _mm_and_si128(_mm_srli_epi32(c, 2), _mm_set1_epi32(0x3F3F3F3F))), opaque);
+            const __m128i half_dim = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(dim, 1), _mm_set1_epi32(0x7F7F7F7F)), opaque);
+
+            // Broadcast each pixel to a 4 wide cell row, with the gap color in its last lane
+            __m128i cell[4], scan_cell[4];
+            cell[0] = select_si128(gap_lane, _mm_shuffle_epi32(dim, 0x00), _mm_shuffle_epi32(c, 0x00));
+            cell[1] = select_si128(gap_lane, _mm_shuffle_epi32(dim, 0x55), _mm_shuffle_epi32(c, 0x55));
+            cell[2] = select_si128(gap_lane, _mm_shuffle_epi32(dim, 0xAA), _mm_shuffle_epi32(c, 0xAA));
+            cell[3] = select_si128(gap_lane, _mm_shuffle_epi32(dim, 0xFF), _mm_shuffle_epi32(c, 0xFF));
+            scan_cell[0] = select_si128(gap_lane, _mm_shuffle_epi32(half_dim, 0x00), _mm_shuffle_epi32(half, 0x00));
+            scan_cell[1] = select_si128(gap_lane, _mm_shuffle_epi32(half_dim, 0x55), _mm_shuffle_epi32(half, 0x55));
+            scan_cell[2] = select_si128(gap_lane, _mm_shuffle_epi32(half_dim, 0xAA), _mm_shuffle_epi32(half, 0xAA));
+            scan_cell[3] = select_si128(gap_lane, _mm_shuffle_epi32(half_dim, 0xFF), _mm_shuffle_epi32(half, 0xFF));
+
+            for (int p = 0; p < 4; p++) {
+                _mm_storeu_si128((__m128i *)&out[4 * (x + p)], cell[p]);
+                _mm_storeu_si128((__m128i *)&scanline[4 * (x + p)], scan_cell[p]);
+            }
+        }
+#endif
+
+        for (; x < w; x++) {
+            const uint32_t c = row[x];
+            const uint32_t dim = (c - ((c >> 2) & 0x3F3F3F3F)) | RGBA_OPAQUE;
+            const uint32_t half = ((c >> 1) & 0x7F7F7F7F) | RGBA_OPAQUE;
+            const uint32_t half_dim = ((dim >> 1) & 0x7F7F7F7F) | RGBA_OPAQUE;
+
+            out[4 * x] = out[4 * x + 1] = out[4 * x + 2] = c;
+            out[4 * x + 3] = dim;
+            scanline[4 * x] = scanline[4 * x + 1] = scanline[4 * x + 2] = half;
+            scanline[4 * x + 3] = half_dim;
+        }
+
+        // Rows 1 & 2 of each cell are the same as row 0
+        memcpy(&dst[(4 * y + 1) * dst_pitch], out, 4 * w * sizeof out[0]);
+        memcpy(&dst[(4 * y + 2) * dst_pitch], out, 4 * w * sizeof out[0]);
+    }
+}
+
+// Upscale w x h pixel colors with the filter, into dst with a row pitch of dst_pitch pixels.
+//   dst must hold filter_scale(filter) times the width & height.
+void upscale(const filter_t filter, const uint32_t src[], const uint32_t w, const uint32_t h,
+             uint32_t dst[], const uint32_t dst_pitch) {
+    static uint32_t scale2x_out[SCALER_MAX_WIDTH * 2 * SCALER_MAX_HEIGHT * 2];
+
+    switch (filter) {
+        case FILTER_NEAREST:
+            for (uint32_t y = 0; y < h; y++)
+                memcpy(&dst[y * dst_pitch], &src[y * w], w * sizeof src[0]);
+            break;
+
+        case FILTER_SCALE2X:
+            scale2x(src, w, h, w, dst, dst_pitch);
+            break;
+
+        case FILTER_SCALE3X:
+            scale3x(src, w, h, dst, dst_pitch);
+            break;
+
+        case FILTER_SCALE4X:
+            // Scale4x is Scale2x applied twice
+            scale2x(src, w, h, w, scale2x_out, 2 * w);
+            scale2x(scale2x_out, 2 * w, 2 * h, 2 * w, dst, dst_pitch);
+            break;
+
+        case FILTER_CRT:
+            crt(src, w, h, dst, dst_pitch);
+            break;
+
+        default:
+            break;
+    }
+}
@@ -3,7 +3,7 @@
 #include <stdlib.h>
 #include "chip8.h"
 
-bool init_sdl(sdl_t *sdl, config_t *config) {
+bool init_sdl(sdl_t *sdl, config_t *config, audio_t *audio) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
         SDL_Log("Could not initialize SDL subsystems! %s\n", SDL_GetError());
         return false;
@@ -19,20 +19,34 @@ bool init_sdl(sdl_t *sdl, config_t *config) {
         return false;
     }
 
-    sdl->renderer = SDL_CreateRenderer(sdl->window, -1, SDL_RENDERER_ACCELERATED);
+    sdl->renderer = SDL_CreateRenderer(sdl->window, -1,
+                                       SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (!sdl->renderer) {
         SDL_Log("Could not create SDL renderer %s\n", SDL_GetError());
         return false;
     }
 
+    // Streaming textures for the upscaling filters, sized to each filter's output
+    for (filter_t f = FILTER_NEAREST; f < FILTER_COUNT; f++) {
+        const uint32_t scale = filter_scale(f);
+        sdl->textures[f] = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                             SDL_TEXTUREACCESS_STREAMING,
+                                             config->window_width * scale,
+                                             config->window_height * scale);
+        if (!sdl->textures[f]) {
+            SDL_Log("Could not create SDL texture %s\n", SDL_GetError());
+            return false;
+        }
+    }
+
     // Init Audio stuff
     sdl->want = (SDL_AudioSpec){
-        .freq = 44100,          // 44100hz "CD" quality
+        .freq = config->audio_sample_rate,
         .format = AUDIO_S16LSB, // Signed 16 bit little endian
         .channels = 1,          // Mono, 1 channel
         .samples = 512,
         .callback = audio_callback,
-        .userdata = config,        // Userdata passed to audio callback
+        .userdata = audio,      // Userdata passed to audio callback, the sample ring buffer
     };
 
     sdl->dev = SDL_OpenAudioDevice(NULL, 0, &sdl->want, &sdl->have, 0);
@@ -49,32 +63,23 @@ bool init_sdl(sdl_t *sdl, config_t *config) {
         return false;
     }
 
+    // Render samples at the rate the device actually runs at, keep ~2 device buffers queued
+    audio->sample_rate = sdl->have.freq;
+    audio->target_fill = 2 * sdl->have.samples;
+    audio->square_wave_freq = config->square_wave_freq;
+    SDL_AtomicSet(&audio->volume, config->volume);
+
+    SDL_PauseAudioDevice(sdl->dev, 0);  // Always playing, silence is rendered as samples
+
     return true;    // Success
 }
 
 // Final cleanup
 void final_cleanup(const sdl_t sdl) {
+    for (filter_t f = FILTER_NEAREST; f < FILTER_COUNT; f++)
+        SDL_DestroyTexture(sdl.textures[f]);
     SDL_DestroyRenderer(sdl.renderer);
     SDL_DestroyWindow(sdl.window);
     SDL_CloseAudioDevice(sdl.dev);
     SDL_Quit(); // Shut down SDL subsystem
 }
-
-void audio_callback(void *userdata, uint8_t *stream, int len) {
-    config_t *config = (config_t *)userdata;
-
-    int16_t *audio_data = (int16_t *)stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = config->audio_sample_rate / config->square_wave_freq;
-    const int32_t half_square_wave_period = square_wave_period / 2;
-
-    // We are filling out 2 bytes at a time (int16_t), len is in bytes,
-    //   so divide by 2
-    // If the current chunk of audio for the square wave is the crest of the wave,
-    //   this will add the volume, otherwise it is the trough of the wave, and will add
-    //   "negative" volume
-    for (int i = 0; i < len / 2; i++)
-        audio_data[i] = ((running_sample_index++ / half_square_wave_period) % 2) ?
-                        config->volume :
-                        -config->volume;
-}
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "chip8.h"
+
+// Trace file layout:
+//   Header: "C8TR", version, record size, 2 reserved bytes
+//   Blocks: u32 record count, u32 compressed size, compressed data (all little endian)
+//   End: a block with 0 records & size 0, written on close; a trace without it is truncated
+// Each block is compressed independently. Every record is compared byte by byte with a
+//   prediction, the previous record with PC advanced by 2; a varint bitmask of the bytes that
+//   differ is written followed by only those bytes. Most instructions change 2-4 bytes.
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 2
+#define TRACE_MAX_BUFFERS 8     // Bounds memory use, emulation waits if the writer falls behind
+#define TRACE_MAX_COMPRESSED (TRACE_BUFFER_RECORDS * (TRACE_RECORD_SIZE + 2))
+
+// Byte order puts the bytes that change most often first, so their mask bits fit in 1 varint byte
+static void pack_record(const trace_record_t *record, uint8_t out[TRACE_RECORD_SIZE]) {
+    out[0] = record->opcode & 0xFF;
+    out[1] = record->opcode >> 8;
+    out[2] = record->VX;
+    out[3] = record->VF;
+    out[4] = record->X;
+    out[5] = record->I & 0xFF;
+    out[6] = record->PC & 0xFF;
+    out[7] = record->PC >> 8;
+    out[8] = record->I >> 8;
+}
+
+static void unpack_record(const uint8_t in[TRACE_RECORD_SIZE], trace_record_t *record) {
+    record->opcode = in[0] | (in[1] << 8);
+    record->VX = in[2];
+    record->VF = in[3];
+    record->X = in[4];
+    record->I = in[5] | (in[8] << 8);
+    record->PC = in[6] | (in[7] << 8);
+}
+
+// Predicted next record bytes: same as the last one, with PC at the next instruction
+static void predict_record(const uint8_t prev[TRACE_RECORD_SIZE], uint8_t out[TRACE_RECORD_SIZE]) {
+    const uint16_t PC = (prev[6] | (prev[7] << 8)) + 2;
+    memcpy(out, prev, TRACE_RECORD_SIZE);
+    out[6] = PC & 0xFF;
+    out[7] = PC >> 8;
+}
+
+static void write_u32(uint8_t out[4], const uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (value >> (i * 8)) & 0xFF;
+}
+
+static uint32_t read_u32(const uint8_t in[4]) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// Compress a buffer of records, returns compressed size
+static uint32_t compress_block(const trace_buffer_t *buffer, uint8_t out[]) {
+    uint8_t prev[TRACE_RECORD_SIZE] = {0};
+    uint32_t size = 0;
+
+    for (uint32_t i = 0; i < buffer->count; i++) {
+        uint8_t bytes[TRACE_RECORD_SIZE], predicted[TRACE_RECORD_SIZE];
+        pack_record(&buffer->records[i], bytes);
+        predict_record(prev, predicted);
+
+        uint16_t mask = 0;
+        for (uint32_t j = 0; j < TRACE_RECORD_SIZE; j++)
+            if (bytes[j] != predicted[j]) mask |= 1 << j;
+
+        // Mask as varint, 7 bits per byte
+        if (mask < 0x80) {
+            out[size++] = mask;
+        } else {
+            out[size++] = 0x80 | (mask & 0x7F);
+            out[size++] = mask >> 7;
+        }
+
+        for (uint32_t j = 0; j < TRACE_RECORD_SIZE; j++)
+            if (mask & (1 << j)) out[size++] = bytes[j];
+
+        memcpy(prev, bytes, TRACE_RECORD_SIZE);
+    }
+
+    return size;
+}
+
+// Background writer thread, compresses & writes full buffers in the order they were handed off.
+//   If it can't, tracing is disabled: failed is set and buffers still queued are dropped.
+static int trace_writer_thread(void *data) {
+    trace_t *trace = data;
+    uint8_t *compressed = malloc(TRACE_MAX_COMPRESSED);
+
+    SDL_LockMutex(trace->lock);
+    if (!compressed) {
+        SDL_Log("Could not allocate trace compression buffer, tracing disabled\n");
+        trace->failed = true;
+    }
+
+    while (true) {
+        while (!trace->full && !trace->quit)
+            SDL_CondWait(trace->cond, trace->lock);
+
+        trace_buffer_t *buffer = trace->full;
+        if (!buffer) break;     // Quit, and everything is written
+        trace->full = buffer->next;
+        const bool failed = trace->failed;
+        SDL_UnlockMutex(trace->lock);
+
+        // Compress & write without holding the lock
+        bool written = failed;
+        if (!failed) {
+            uint8_t header[8];
+            const uint32_t size = compress_block(buffer, compressed);
+            write_u32(&header[0], buffer->count);
+            write_u32(&header[4], size);
+            written = fwrite(header, sizeof header, 1, trace->file) == 1 &&
+                      fwrite(compressed, size, 1, trace->file) == 1;
+            if (written) {
+                trace->records += buffer->count;
+                trace->bytes += sizeof header + size;
+            }
+        }
+
+        SDL_LockMutex(trace->lock);
+        if (!written) {
+            SDL_Log("Could not write trace file, tracing disabled\n");
+            trace->failed = true;
+        }
+        buffer->count = 0;
+        buffer->next = trace->free;
+        trace->free = buffer;
+        SDL_CondBroadcast(trace->cond);
+    }
+    SDL_UnlockMutex(trace->lock);
+
+    free(compressed);
+    return 0;
+}
+
+// Hand the current buffer to the writer thread and get an empty one to keep filling
+static void trace_handoff(trace_t *trace) {
+    SDL_LockMutex(trace->lock);
+
+    // Writer failed, drop the records rather than wait for buffers it may never give back
+    if (trace->failed) {
+        trace->current->count = 0;
+        SDL_UnlockMutex(trace->lock);
+        return;
+    }
+
+    // Append to the end of the queue, it is at most TRACE_MAX_BUFFERS long
+    trace_buffer_t **tail = &trace->full;
+    while (*tail) tail = &(*tail)->next;
+    trace->current->next = NULL;
+    *tail = trace->current;
+
+    if (!trace->free && trace->num_buffers < TRACE_MAX_BUFFERS) {
+        trace_buffer_t *buffer = calloc(1, sizeof *buffer);
+        if (buffer) {
+            buffer->next = trace->free;
+            trace->free = buffer;
+            trace->num_buffers++;
+        }
+    }
+
+    SDL_CondBroadcast(trace->cond);
+    while (!trace->free)
+        SDL_CondWait(trace->cond, trace->lock);     // Writer is behind, wait for it
+
+    trace->current = trace->free;
+    trace->free = trace->current->next;
+
+    SDL_UnlockMutex(trace->lock);
+}
+
+// Record the instruction just executed; only called when tracing is enabled
+void trace_instruction(trace_t *trace, const chip8_t *chip8, const uint16_t PC) {
+    trace_buffer_t *buffer = trace->current;
+
+    buffer->records[buffer->count++] = (trace_record_t){
+        .PC = PC,
+        .opcode = chip8->inst.opcode,
+        .I = chip8->I,
+        .X = chip8->inst.X,
+        .VX = chip8->V[chip8->inst.X],
+        .VF = chip8->V[0xF],
+    };
+
+    if (buffer->count == TRACE_BUFFER_RECORDS)
+        trace_handoff(trace);
+}
+
+bool start_trace(trace_t *trace, const char path[]) {
+    memset(trace, 0, sizeof *trace);
+
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        SDL_Log("Could not open trace file %s\n", path);
+        return false;
+    }
+
+    const uint8_t header[8] = { 'C', '8', 'T', 'R', TRACE_VERSION, TRACE_RECORD_SIZE, 0, 0 };
+    if (fwrite(header, sizeof header, 1, trace->file) != 1) {
+        SDL_Log("Could not write trace file %s\n", path);
+        fclose(trace->file);
+        return false;
+    }
+
+    trace->current = calloc(1, sizeof *trace->current);
+    trace->num_buffers = 1;
+    trace->lock = SDL_CreateMutex();
+    trace->cond = SDL_CreateCond();
+    if (!trace->current || !trace->lock || !trace->cond) {
+        SDL_Log("Could not allocate trace buffers %s\n", SDL_GetError());
+        return false;
+    }
+
+    trace->thread = SDL_CreateThread(trace_writer_thread, "CHIP8 Trace Writer", trace);
+    if (!trace->thread) {
+        SDL_Log("Could not create trace writer thread %s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;    // Success
+}
+
+// Flush remaining records, wait for the writer thread and close the trace file
+void stop_trace(trace_t *trace) {
+    SDL_LockMutex(trace->lock);
+    if (trace->current->count > 0) {
+        trace_buffer_t **tail = &trace->full;
+        while (*tail) tail = &(*tail)->next;
+        trace->current->next = NULL;
+        *tail = trace->current;
+        trace->current = NULL;
+    }
+    trace->quit = true;
+    SDL_CondBroadcast(trace->cond);
+    SDL_UnlockMutex(trace->lock);
+
+    SDL_WaitThread(trace->thread, NULL);
+
+    free(trace->current);
+    while (trace->free) {
+        trace_buffer_t *next = trace->free->next;
+        free(trace->free);
+        trace->free = next;
+    }
+    SDL_DestroyCond(trace->cond);
+    SDL_DestroyMutex(trace->lock);
+
+    // End marker, only if every block made it to the file
+    const uint8_t end[8] = {0};
+    bool complete = !trace->failed && fwrite(end, sizeof end, 1, trace->file) == 1;
+    if (fclose(trace->file) != 0) complete = false;
+    if (!complete) {
+        SDL_Log("Trace is incomplete, %llu instructions written\n", (long long unsigned)trace->records);
+        return;
+    }
+
+    SDL_Log("Trace: %llu instructions, %llu bytes (%.2f bytes/instruction)\n",
+            (long long unsigned)trace->records, (long long unsigned)trace->bytes,
+            trace->records ? (double)trace->bytes / trace->records : 0.0);
+}
+
+// Get the next compressed byte, flags corruption instead of reading past the end
+static uint8_t take_byte(const uint8_t data[], const uint32_t size, uint32_t *pos, bool *corrupt) {
+    if (*pos >= size) {
+        *corrupt = true;
+        return 0;
+    }
+    return data[(*pos)++];
+}
+
+// Open a trace file for reading and check its header
+FILE *open_trace(const char path[]) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        SDL_Log("Could not open trace file %s\n", path);
+        return NULL;
+    }
+
+    uint8_t header[8];
+    if (fread(header, sizeof header, 1, file) != 1 ||
+        memcmp(header, TRACE_MAGIC, 4) != 0 ||
+        header[4] != TRACE_VERSION || header[5] != TRACE_RECORD_SIZE) {
+        SDL_Log("%s is not a CHIP8 trace file, or an unsupported version\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+// Read & decompress the next block of records into records, which must have room for
+//   TRACE_BUFFER_RECORDS; count is 0 at the end marker. Returns false if the trace is corrupt
+//   or truncated.
+bool read_trace_block(FILE *file, trace_record_t records[], uint32_t *count) {
+    static uint8_t compressed[TRACE_MAX_COMPRESSED];
+    uint8_t header[8];
+
+    *count = 0;
+    if (fread(header, sizeof header, 1, file) != 1) {
+        SDL_Log("Truncated trace, it has no end marker\n");
+        return false;
+    }
+
+    const uint32_t records_in_block = read_u32(&header[0]);
+    const uint32_t size = read_u32(&header[4]);
+    if (records_in_block == 0 && size == 0) return true;   // End marker
+
+    if (records_in_block > TRACE_BUFFER_RECORDS || size > sizeof compressed ||
+        fread(compressed, size, 1, file) != 1) {
+        SDL_Log("Corrupt or truncated trace block\n");
+        return false;
+    }
+
+    uint8_t prev[TRACE_RECORD_SIZE] = {0};
+    uint32_t in = 0;
+    bool corrupt = false;
+
+    for (uint32_t i = 0; i < records_in_block && !corrupt; i++) {
+        uint8_t bytes[TRACE_RECORD_SIZE];
+        predict_record(prev, bytes);
+
+        // Varint mask, then the bytes that differ from the prediction
+        uint16_t mask = take_byte(compressed, size, &in, &corrupt);
+        if (mask & 0x80) mask = (mask & 0x7F) | (take_byte(compressed, size, &in, &corrupt) << 7);
+
+        for (uint32_t j = 0; j < TRACE_RECORD_SIZE; j++)
+            if (mask & (1 << j)) bytes[j] = take_byte(compressed, size, &in, &corrupt);
+
+        unpack_record(bytes, &records[i]);
+        memcpy(prev, bytes, TRACE_RECORD_SIZE);
+    }
+
+    if (corrupt || in != size) {
+        SDL_Log("Corrupt trace block\n");
+        return false;
+    }
+
+    *count = records_in_block;
+    return true;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// chip8_tracediff: Compare two execution traces and report the first instruction where they diverge
+
+static void print_record(const char *label, const uint64_t index, const trace_record_t *record) {
+    printf("  %s #%llu: PC=0x%03X opcode=0x%04X I=0x%03X V%X=0x%02X VF=0x%02X\n",
+           label, (long long unsigned)index, record->PC, record->opcode,
+           record->I, record->X, record->VX, record->VF);
+}
+
+static bool records_equal(const trace_record_t *a, const trace_record_t *b) {
+    return a->PC == b->PC && a->opcode == b->opcode && a->I == b->I &&
+           a->X == b->X && a->VX == b->VX && a->VF == b->VF;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <trace_a> <trace_b>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *file_a = open_trace(argv[1]);
+    FILE *file_b = open_trace(argv[2]);
+    if (!file_a || !file_b) exit(EXIT_FAILURE);
+
+    static trace_record_t block_a[TRACE_BUFFER_RECORDS], block_b[TRACE_BUFFER_RECORDS];
+    uint32_t count_a = 0, count_b = 0, pos_a = 0, pos_b = 0;
+    trace_record_t last = {0};
+    uint64_t index = 0;
+
+    while (true) {
+        // Blocks of the two traces need not line up, refill each side independently
+        if (pos_a == count_a) {
+            if (!read_trace_block(file_a, block_a, &count_a)) {
+                printf("Trace %s is corrupt or truncated after instruction #%llu\n", argv[1], (long long unsigned)index);
+                exit(EXIT_FAILURE);
+            }
+            pos_a = 0;
+        }
+        if (pos_b == count_b) {
+            if (!read_trace_block(file_b, block_b, &count_b)) {
+                printf("Trace %s is corrupt or truncated after instruction #%llu\n", argv[2], (long long unsigned)index);
+                exit(EXIT_FAILURE);
+            }
+            pos_b = 0;
+        }
+
+        if (count_a == 0 || count_b == 0) {
+            if (count_a == count_b) {
+                printf("Traces are identical, %llu instructions\n", (long long unsigned)index);
+                exit(EXIT_SUCCESS);
+            }
+
+            printf("Traces diverge at instruction #%llu: %s ends first\n",
+                   (long long unsigned)index, count_a == 0 ? argv[1] : argv[2]);
+            exit(EXIT_FAILURE);
+        }
+
+        const trace_record_t *a = &block_a[pos_a++];
+        const trace_record_t *b = &block_b[pos_b++];
+
+        if (!records_equal(a, b)) {
+            printf("Traces diverge at instruction #%llu\n", (long long unsigned)index);
+            if (index > 0) print_record("last common", index - 1, &last);
+            print_record(argv[1], index, a);
+            print_record(argv[2], index, b);
+            exit(EXIT_FAILURE);
+        }
+
+        last = *a;
+        index++;
+    }
+}